@@ -0,0 +1,53 @@
+#include "AdmissionControl.hpp"
+
+AdmissionControl::AdmissionControl(size_t max_sessions, size_t max_per_ip, size_t max_per_user)
+    : max_sessions_(max_sessions), max_per_ip_(max_per_ip), max_per_user_(max_per_user) {}
+
+bool AdmissionControl::admitClient(const std::string& ip) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_sessions_ > 0 && stats_.sessions >= max_sessions_) {
+        ++stats_.rejected_total;
+        return false;
+    }
+    size_t& count = per_ip_[ip];
+    if (max_per_ip_ > 0 && count >= max_per_ip_) {
+        ++stats_.rejected_ip;
+        return false;
+    }
+    ++count;
+    ++stats_.sessions;
+    return true;
+}
+
+void AdmissionControl::releaseClient(const std::string& ip) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    release(per_ip_, ip);
+    --stats_.sessions;
+}
+
+bool AdmissionControl::admitUser(const std::string& user) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t& count = per_user_[user];
+    if (max_per_user_ > 0 && count >= max_per_user_) {
+        ++stats_.rejected_user;
+        return false;
+    }
+    ++count;
+    return true;
+}
+
+void AdmissionControl::releaseUser(const std::string& user) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    release(per_user_, user);
+}
+
+// Drops keys at zero so the maps only hold connected clients
+void AdmissionControl::release(std::unordered_map<std::string, size_t>& counts, const std::string& key) {
+    auto it = counts.find(key);
+    if (it != counts.end() && --it->second == 0) counts.erase(it);
+}
+
+AdmissionControl::Stats AdmissionControl::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Counts sessions in total, per client address and per logged in user, and
+// refuses new ones beyond the configured limits (0 = unlimited). Refused
+// clients get a 421 and are disconnected by the caller.
+class AdmissionControl {
+public:
+    struct Stats {
+        size_t sessions = 0;
+        uint64_t rejected_total = 0; // max_sessions reached
+        uint64_t rejected_ip = 0;
+        uint64_t rejected_user = 0;
+    };
+
+    AdmissionControl(size_t max_sessions = 0, size_t max_per_ip = 0, size_t max_per_user = 0);
+
+    bool admitClient(const std::string& ip);
+    void releaseClient(const std::string& ip);
+    bool admitUser(const std::string& user);
+    void releaseUser(const std::string& user);
+
+    Stats stats() const;
+
+private:
+    size_t max_sessions_;
+    size_t max_per_ip_;
+    size_t max_per_user_;
+    std::unordered_map<std::string, size_t> per_ip_;
+    std::unordered_map<std::string, size_t> per_user_;
+    Stats stats_;
+    mutable std::mutex mutex_;
+
+    static void release(std::unordered_map<std::string, size_t>& counts, const std::string& key);
+};
@@ -1,21 +1,84 @@
 #include "CommandParser.hpp"
-#include <algorithm>
 
-std::tuple<std::string, std::string> CommandParser::parse(const std::string& line) {
-    std::string trimmed = line;
+Command CommandParser::parse(std::string_view line) {
     // Remove trailing \r\n or \n
-    while (!trimmed.empty() && (trimmed.back() == '\r' || trimmed.back() == '\n')) {
-        trimmed.pop_back();
+    while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) {
+        line.remove_suffix(1);
     }
+    Command command;
     // Split command and argument
-    auto space = trimmed.find(' ');
-    if (space == std::string::npos) {
-        std::string cmd = trimmed;
-        std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
-        return {cmd, ""};
+    auto space = line.find(' ');
+    if (space == std::string_view::npos) {
+        command.verb = line;
+    } else {
+        command.verb = line.substr(0, space);
+        command.arg = line.substr(space + 1);
     }
-    std::string cmd = trimmed.substr(0, space);
-    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
-    std::string arg = trimmed.substr(space + 1);
-    return {cmd, arg};
+    command.id = lookup(verbCode(command.verb));
+    return command;
+}
+
+// The switch on the packed verb compiles to a handful of integer compares
+CommandId CommandParser::lookup(uint64_t code) {
+    switch (code) {
+    case verbCode("USER"): return CommandId::USER;
+    case verbCode("PASS"): return CommandId::PASS;
+    case verbCode("QUIT"): return CommandId::QUIT;
+    case verbCode("NOOP"): return CommandId::NOOP;
+    case verbCode("PASV"): return CommandId::PASV;
+    case verbCode("EPSV"): return CommandId::EPSV;
+    case verbCode("PORT"): return CommandId::PORT;
+    case verbCode("EPRT"): return CommandId::EPRT;
+    case verbCode("LIST"): return CommandId::LIST;
+    case verbCode("NLST"): return CommandId::NLST;
+    case verbCode("MLSD"): return CommandId::MLSD;
+    case verbCode("RETR"): return CommandId::RETR;
+    case verbCode("STOR"): return CommandId::STOR;
+    case verbCode("APPE"): return CommandId::APPE;
+    case verbCode("ALLO"): return CommandId::ALLO;
+    case verbCode("REST"): return CommandId::REST;
+    case verbCode("RANG"): return CommandId::RANG;
+    case verbCode("SIZE"): return CommandId::SIZE;
+    case verbCode("MDTM"): return CommandId::MDTM;
+    case verbCode("TYPE"): return CommandId::TYPE;
+    case verbCode("MODE"): return CommandId::MODE;
+    case verbCode("FEAT"): return CommandId::FEAT;
+    case verbCode("DELE"): return CommandId::DELE;
+    case verbCode("RNFR"): return CommandId::RNFR;
+    case verbCode("RNTO"): return CommandId::RNTO;
+    case verbCode("CWD"): return CommandId::CWD;
+    case verbCode("CDUP"): return CommandId::CDUP;
+    case verbCode("PWD"): return CommandId::PWD;
+    case verbCode("MKD"): return CommandId::MKD;
+    case verbCode("RMD"): return CommandId::RMD;
+    case verbCode("HASH"): return CommandId::HASH;
+    case verbCode("XCRC"): return CommandId::XCRC;
+    case verbCode("XMD5"): return CommandId::XMD5;
+    case verbCode("XSHA256"): return CommandId::XSHA256;
+    case verbCode("OPTS"): return CommandId::OPTS;
+    case verbCode("AUTH"): return CommandId::AUTH;
+    case verbCode("PBSZ"): return CommandId::PBSZ;
+    case verbCode("PROT"): return CommandId::PROT;
+    case verbCode("SITE"): return CommandId::SITE;
+    default: return CommandId::Unknown;
+    }
+}
+
+const char* CommandParser::name(CommandId id) {
+    static const char* const names[] = {
+        "",
+        "USER", "PASS", "QUIT", "NOOP",
+        "PASV", "EPSV", "PORT", "EPRT",
+        "LIST", "NLST", "MLSD",
+        "RETR", "STOR", "APPE", "ALLO", "REST", "RANG",
+        "SIZE", "MDTM", "TYPE", "MODE", "FEAT",
+        "DELE", "RNFR", "RNTO",
+        "CWD", "CDUP", "PWD", "MKD", "RMD",
+        "HASH", "XCRC", "XMD5", "XSHA256", "OPTS",
+        "AUTH", "PBSZ", "PROT",
+        "SITE",
+    };
+    static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(CommandId::Count),
+                  "names must follow CommandId");
+    return names[static_cast<size_t>(id)];
 }
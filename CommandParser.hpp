@@ -1,9 +1,49 @@
 #pragma once
-#include <string>
-#include <tuple>
+#include <cstdint>
+#include <string_view>
+
+enum class CommandId : uint8_t {
+    Unknown,
+    USER, PASS, QUIT, NOOP,
+    PASV, EPSV, PORT, EPRT,
+    LIST, NLST, MLSD,
+    RETR, STOR, APPE, ALLO, REST, RANG,
+    SIZE, MDTM, TYPE, MODE, FEAT,
+    DELE, RNFR, RNTO,
+    CWD, CDUP, PWD, MKD, RMD,
+    HASH, XCRC, XMD5, XSHA256, OPTS,
+    AUTH, PBSZ, PROT,
+    SITE,
+    Count
+};
+
+// A parsed command line. verb and arg point into the parsed line.
+struct Command {
+    CommandId id = CommandId::Unknown;
+    std::string_view verb;
+    std::string_view arg;
+};
 
 class CommandParser {
 public:
-    // Returns (cmd, argument)
-    static std::tuple<std::string, std::string> parse(const std::string& line);
+    // Splits "VERB arg" without allocating. The verb is matched case-insensitively.
+    static Command parse(std::string_view line);
+
+    // Packs a verb of up to 8 letters/digits into one integer, upper-cased.
+    // Returns 0 for anything else.
+    static constexpr uint64_t verbCode(std::string_view verb) {
+        if (verb.empty() || verb.size() > 8) return 0;
+        uint64_t code = 0;
+        for (char c : verb) {
+            if (c >= 'a' && c <= 'z') c = static_cast<char>(c - 'a' + 'A');
+            else if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) return 0;
+            code = (code << 8) | static_cast<unsigned char>(c);
+        }
+        return code;
+    }
+
+    static CommandId lookup(uint64_t code);
+
+    // Upper-case verb of a known command, "" for Unknown
+    static const char* name(CommandId id);
 };
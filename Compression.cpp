@@ -0,0 +1,368 @@
+#include "Compression.hpp"
+#include "DataTransfer.hpp"
+#include "Logger.hpp"
+#include "RateLimiter.hpp"
+#include "Tls.hpp"
+
+#include <zlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+const size_t BLOCK_SIZE = 1 << 20;   // input per parallel block
+const size_t STREAM_CHUNK = 256 * 1024;
+
+std::atomic<int> level{Z_DEFAULT_COMPRESSION};
+
+// One deflate or inflate stream per thread and kind, reset between uses
+struct ZlibContext {
+    z_stream zs{};
+    bool ready = false;
+    bool inflating = false;
+    ~ZlibContext() {
+        if (!ready) return;
+        if (inflating) inflateEnd(&zs);
+        else deflateEnd(&zs);
+    }
+};
+
+// window_bits 15 = zlib format, -15 = raw deflate for blocks
+z_stream* threadDeflater(int window_bits) {
+    thread_local ZlibContext zlib_ctx, raw_ctx;
+    thread_local int zlib_level = 0, raw_level = 0;
+    ZlibContext& ctx = window_bits > 0 ? zlib_ctx : raw_ctx;
+    int& ctx_level = window_bits > 0 ? zlib_level : raw_level;
+    int want = level.load(std::memory_order_relaxed);
+    if (ctx.ready && ctx_level != want) {
+        deflateEnd(&ctx.zs);
+        ctx.ready = false;
+    }
+    if (ctx.ready) {
+        deflateReset(&ctx.zs);
+    } else {
+        ctx.zs = z_stream{};
+        if (deflateInit2(&ctx.zs, want, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return nullptr;
+        ctx.ready = true;
+        ctx_level = want;
+    }
+    return &ctx.zs;
+}
+
+z_stream* threadInflater() {
+    thread_local ZlibContext ctx;
+    if (ctx.ready) {
+        inflateReset(&ctx.zs);
+    } else {
+        ctx.zs = z_stream{};
+        if (inflateInit(&ctx.zs) != Z_OK) return nullptr;
+        ctx.ready = true;
+        ctx.inflating = true;
+    }
+    return &ctx.zs;
+}
+
+// Fixed-size pool for block compression
+class BlockPool {
+public:
+    void start(unsigned threads) {
+        for (unsigned i = 0; i < threads; ++i) workers_.emplace_back([this]() { run(); });
+    }
+    unsigned size() const { return (unsigned)workers_.size(); }
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(job));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> queue_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    void run() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return !queue_.empty(); });
+                job = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+BlockPool pool;
+
+struct Block {
+    std::vector<char> out;
+    uLong adler = 1;
+    size_t in_len = 0;
+    bool ok = false;
+};
+
+bool readFull(int fd, char* buf, size_t len, off_t pos, size_t& got) {
+    got = 0;
+    while (got < len) {
+        ssize_t n = pread(fd, buf + got, len - got, pos + got);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+        got += n;
+    }
+    return true;
+}
+
+// Raw deflate of one block. All but the last end on a sync flush, which
+// leaves the stream byte aligned and open, so the blocks concatenate.
+Block compressBlock(int file_fd, off_t pos, size_t len, bool last) {
+    thread_local std::vector<char> in;
+    in.resize(BLOCK_SIZE);
+    Block block;
+    z_stream* zs = threadDeflater(-15);
+    // A file that shrank mid-transfer cannot be finished consistently
+    if (!zs || !readFull(file_fd, in.data(), len, pos, block.in_len) || block.in_len < len) return block;
+    block.out.resize(deflateBound(zs, block.in_len) + 16);
+    zs->next_in = reinterpret_cast<Bytef*>(in.data());
+    zs->avail_in = (uInt)block.in_len;
+    zs->next_out = reinterpret_cast<Bytef*>(block.out.data());
+    zs->avail_out = (uInt)block.out.size();
+    int rc = deflate(zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (rc != Z_OK && rc != Z_STREAM_END) return block;
+    block.out.resize(block.out.size() - zs->avail_out);
+    block.adler = adler32(1, reinterpret_cast<const Bytef*>(in.data()), (uInt)block.in_len);
+    block.ok = true;
+    return block;
+}
+
+// zlib stream header for the configured level (RFC 1950 section 2.2)
+void zlibHeader(unsigned char header[2]) {
+    int lvl = level.load(std::memory_order_relaxed);
+    int flevel = lvl == Z_DEFAULT_COMPRESSION || lvl == 6 ? 2 : lvl < 2 ? 0 : lvl < 6 ? 1 : 3;
+    header[0] = 0x78;
+    header[1] = (unsigned char)(flevel << 6);
+    header[1] += 31 - (header[0] * 256 + header[1]) % 31;
+}
+
+void bigEndian(unsigned char out[4], uLong value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+} // namespace
+
+void Compression::init(int compression_level, unsigned threads) {
+    level = compression_level;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    pool.start(threads);
+}
+
+ssize_t Compression::sendFile(DataChannel& channel, int file_fd, off_t offset, off_t length) {
+    struct stat st;
+    if (fstat(file_fd, &st) == -1) return -1;
+    off_t end = st.st_size;
+    if (length >= 0 && offset + length < end) end = offset + length;
+    if (offset > end) offset = end;
+
+    if (end - offset < (off_t)(2 * BLOCK_SIZE) || pool.size() == 0) {
+        // Small enough for one stream on this thread
+        Writer writer(channel);
+        std::vector<char> buf(STREAM_CHUNK);
+        for (off_t pos = offset; pos < end;) {
+            size_t want = std::min<off_t>(buf.size(), end - pos), got;
+            // A file that shrank aborts the transfer, as in compressBlock
+            if (!readFull(file_fd, buf.data(), want, pos, got) || got < want) return -1;
+            if (!writer.write(buf.data(), got)) return -1;
+            pos += got;
+        }
+        return writer.finish() ? end - offset : -1;
+    }
+
+    unsigned char header[2];
+    zlibHeader(header);
+    if (!channel.send(reinterpret_cast<char*>(header), 2)) return -1;
+
+    // Keep a bounded window of blocks in flight so memory stays at
+    // about 2 * threads compressed blocks
+    const size_t window = 2 * pool.size();
+    std::deque<std::future<Block>> pending;
+    off_t next = offset;
+    uLong adler = 1;
+    ssize_t total = 0;
+    bool ok = true;
+    while (ok && (next < end || !pending.empty())) {
+        while (next < end && pending.size() < window) {
+            size_t len = std::min<off_t>(BLOCK_SIZE, end - next);
+            bool last = next + (off_t)len >= end;
+            auto task = std::make_shared<std::packaged_task<Block()>>(
+                [file_fd, next, len, last]() { return compressBlock(file_fd, next, len, last); });
+            pending.push_back(task->get_future());
+            pool.submit([task]() { (*task)(); });
+            next += len;
+        }
+        Block block = pending.front().get();
+        pending.pop_front();
+        ok = block.ok && channel.send(block.out.data(), block.out.size());
+        adler = adler32_combine(adler, block.adler, block.in_len);
+        total += block.in_len;
+    }
+    // Jobs still queued reference file_fd, wait for them before returning
+    for (auto& f : pending) f.wait();
+    if (!ok) return -1;
+
+    unsigned char trailer[4];
+    bigEndian(trailer, adler);
+    return channel.send(reinterpret_cast<char*>(trailer), 4) ? total : -1;
+}
+
+bool Compression::gzipSibling(int gz_fd, int file_fd, off_t& data_offset, off_t& data_length) {
+    struct stat gz_st, st;
+    if (fstat(gz_fd, &gz_st) == -1 || fstat(file_fd, &st) == -1) return false;
+    if (!S_ISREG(gz_st.st_mode) || gz_st.st_mtime < st.st_mtime || gz_st.st_size < 18) return false;
+
+    unsigned char buf[4096];
+    ssize_t n = pread(gz_fd, buf, sizeof(buf), 0);
+    if (n < 18 || buf[0] != 0x1f || buf[1] != 0x8b || buf[2] != 8) return false;
+    int flags = buf[3];
+    size_t pos = 10;
+    if (flags & 4) { // FEXTRA
+        if (pos + 2 > (size_t)n) return false;
+        pos += 2 + (buf[pos] | buf[pos + 1] << 8);
+    }
+    for (int bit : {8, 16}) { // FNAME, FCOMMENT
+        if (!(flags & bit)) continue;
+        while (pos < (size_t)n && buf[pos] != 0) ++pos;
+        ++pos;
+    }
+    if (flags & 2) pos += 2; // FHCRC
+    if (pos >= (size_t)n || (off_t)pos + 8 > gz_st.st_size) return false;
+
+    // ISIZE must match, which also rules out most multi-member files
+    unsigned char trailer[4];
+    if (pread(gz_fd, trailer, 4, gz_st.st_size - 4) != 4) return false;
+    uint32_t isize = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+    if (isize != (uint32_t)st.st_size) return false;
+
+    data_offset = pos;
+    data_length = gz_st.st_size - 8 - pos;
+    return true;
+}
+
+// gzip and zlib wrap the same deflate data; only the zlib trailer's
+// Adler-32 has to be computed, which is far cheaper than compressing
+ssize_t Compression::sendGzipSibling(DataChannel& channel, int gz_fd, off_t data_offset, off_t data_length,
+                                     int file_fd) {
+    unsigned char header[2];
+    zlibHeader(header);
+    if (!channel.send(reinterpret_cast<char*>(header), 2)) return -1;
+    ssize_t body = channel.rawSend()
+                       ? DataTransfer::sendFile(channel.fd, gz_fd, data_offset, data_length, channel.throttle)
+                       : Tls::sendFile(channel, gz_fd, data_offset, data_length);
+    if (body != data_length) return -1;
+
+    std::vector<char> buf(STREAM_CHUNK);
+    uLong adler = 1;
+    off_t pos = 0;
+    size_t got;
+    while (readFull(file_fd, buf.data(), buf.size(), pos, got) && got > 0) {
+        adler = adler32(adler, reinterpret_cast<const Bytef*>(buf.data()), (uInt)got);
+        pos += got;
+    }
+    unsigned char trailer[4];
+    bigEndian(trailer, adler);
+    return channel.send(reinterpret_cast<char*>(trailer), 4) ? pos : -1;
+}
+
+ssize_t Compression::receiveFile(DataChannel& channel, int file_fd, off_t offset) {
+    z_stream* zs = threadInflater();
+    if (!zs) return -1;
+    std::vector<char> in(STREAM_CHUNK), out(STREAM_CHUNK);
+    off_t pos = offset;
+    int rc = Z_OK;
+    while (rc != Z_STREAM_END) {
+        ssize_t n = channel.receive(in.data(), in.size());
+        if (n < 0) return -1;
+        if (n == 0) {
+            Logger::log(Logger::ERROR, "MODE Z upload ended before the end of the compressed stream");
+            errno = EPROTO;
+            return -1;
+        }
+        zs->next_in = reinterpret_cast<Bytef*>(in.data());
+        zs->avail_in = (uInt)n;
+        do {
+            zs->next_out = reinterpret_cast<Bytef*>(out.data());
+            zs->avail_out = (uInt)out.size();
+            rc = inflate(zs, Z_NO_FLUSH);
+            if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR) {
+                Logger::log(Logger::ERROR, std::string("MODE Z upload is not a valid zlib stream: ") +
+                                               (zs->msg ? zs->msg : "error"));
+                errno = EPROTO;
+                return -1;
+            }
+            size_t produced = out.size() - zs->avail_out;
+            for (size_t done = 0; done < produced;) {
+                ssize_t w = pwrite(file_fd, out.data() + done, produced - done, pos);
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    return -1;
+                }
+                done += w;
+                pos += w;
+            }
+        } while (zs->avail_out == 0 && rc != Z_STREAM_END);
+    }
+    return pos - offset;
+}
+
+Compression::Writer::Writer(DataChannel& channel)
+    : channel_(channel), zs_(threadDeflater(15)), out_(STREAM_CHUNK) {
+    ok_ = zs_ != nullptr;
+}
+
+Compression::Writer::~Writer() = default;
+
+bool Compression::Writer::deflateSome(const char* data, size_t len, int flush) {
+    if (!ok_) return false;
+    zs_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs_->avail_in = (uInt)len;
+    int rc;
+    do {
+        zs_->next_out = reinterpret_cast<Bytef*>(out_.data());
+        zs_->avail_out = (uInt)out_.size();
+        rc = deflate(zs_, flush);
+        size_t produced = out_.size() - zs_->avail_out;
+        if (produced > 0 && !channel_.send(out_.data(), produced)) {
+            ok_ = false;
+            return false;
+        }
+    } while (zs_->avail_out == 0 || (flush == Z_FINISH && rc != Z_STREAM_END));
+    return true;
+}
+
+bool Compression::Writer::write(const char* data, size_t len) {
+    return deflateSome(data, len, Z_NO_FLUSH);
+}
+
+bool Compression::Writer::finish() {
+    return deflateSome(nullptr, 0, Z_FINISH);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct DataChannel;
+struct z_stream_s;
+
+// MODE Z (deflate transmission mode): each transfer on the data connection
+// is one zlib stream (RFC 1950). zlib state is kept per thread and reset
+// between transfers rather than allocated for each one.
+class Compression {
+public:
+    // Compression level and the worker threads for parallel block
+    // compression, 0 = one per core. Call once before any transfer.
+    static void init(int level, unsigned threads);
+
+    // Compresses length bytes (-1 = to EOF) of file_fd from offset onto
+    // the data channel. Ranges of several blocks are cut into independently
+    // compressed blocks spread over the worker pool and sent in order as
+    // one stream. Returns the uncompressed bytes sent, -1 on error.
+    static ssize_t sendFile(DataChannel& channel, int file_fd, off_t offset, off_t length);
+
+    // If gz_fd is a single-member gzip of file_fd written after its last
+    // change, returns true and the position of its deflate data
+    static bool gzipSibling(int gz_fd, int file_fd, off_t& data_offset, off_t& data_length);
+    // Sends that deflate data framed as a zlib stream, without recompressing.
+    // Returns the uncompressed size, -1 on error.
+    static ssize_t sendGzipSibling(DataChannel& channel, int gz_fd, off_t data_offset, off_t data_length,
+                                   int file_fd);
+
+    // Inflates the zlib stream arriving on the channel into file_fd at
+    // offset. Returns the bytes written, -1 on error or a truncated stream.
+    static ssize_t receiveFile(DataChannel& channel, int file_fd, off_t offset);
+
+    // Streaming compressor for output produced piece by piece (listings)
+    class Writer {
+    public:
+        explicit Writer(DataChannel& channel);
+        ~Writer();
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        bool write(const char* data, size_t len);
+        // Ends the stream, must be called once after the last write
+        bool finish();
+
+    private:
+        DataChannel& channel_;
+        z_stream_s* zs_;
+        std::vector<char> out_;
+        bool ok_ = true;
+
+        bool deflateSome(const char* data, size_t len, int flush);
+    };
+};
@@ -0,0 +1,642 @@
+#include "DataTransfer.hpp"
+#include "Logger.hpp"
+#include "RateLimiter.hpp"
+
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+// Upper bound per sendfile/splice call, keeps one transfer from hogging the socket
+static const size_t CHUNK_SIZE = 1 << 20;
+
+// A file that ends before the requested range must not look like a
+// complete transfer
+static ssize_t fileShrank() {
+    Logger::log(Logger::ERROR, "File shrank during transfer");
+    errno = EIO;
+    return -1;
+}
+
+static size_t grant(Throttle* throttle, size_t want) {
+    return throttle ? throttle->acquire(want) : want;
+}
+
+static void settle(Throttle* throttle, size_t granted, ssize_t used) {
+    if (throttle) throttle->settle(granted, used > 0 ? used : 0);
+}
+
+bool DataTransfer::sendBuffer(int fd, const char* buf, size_t len, Throttle* throttle) {
+    while (len > 0) {
+        size_t want = grant(throttle, len);
+        ssize_t n = send(fd, buf, want, MSG_NOSIGNAL);
+        settle(throttle, want, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+ssize_t DataTransfer::sendFile(int data_fd, int file_fd, off_t offset, off_t length, Throttle* throttle) {
+    struct stat st;
+    if (fstat(file_fd, &st) == -1) return -1;
+    if (!S_ISREG(st.st_mode)) return sendFileSplice(data_fd, file_fd, offset, length, throttle);
+
+    off_t end = st.st_size;
+    if (length >= 0 && offset + length < end) end = offset + length;
+    off_t pos = offset;
+    while (pos < end) {
+        size_t want = grant(throttle, std::min<off_t>(end - pos, CHUNK_SIZE));
+        ssize_t n = sendfile(data_fd, file_fd, &pos, want);
+        settle(throttle, want, n);
+        if (n < 0) {
+            if (errno == EINTR) continue; // EAGAIN is the data_timeout expiring
+            if ((errno == EINVAL || errno == ENOSYS) && pos == offset) {
+                // Filesystem without sendfile support
+                return sendFileBuffered(data_fd, file_fd, offset, 64 * 1024, end - offset, throttle);
+            }
+            Logger::log(Logger::ERROR, std::string("sendfile failed: ") + strerror(errno));
+            return -1;
+        }
+        if (n == 0) return fileShrank();
+    }
+    return pos - offset;
+}
+
+ssize_t DataTransfer::sendFileSplice(int data_fd, int file_fd, off_t offset, off_t length, Throttle* throttle) {
+    if (offset > 0 && lseek(file_fd, offset, SEEK_SET) == (off_t)-1) return -1;
+
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == -1) return sendFileBuffered(data_fd, file_fd, offset, 64 * 1024, length, throttle);
+
+    ssize_t total = 0;
+    while (length < 0 || total < length) {
+        size_t want = grant(throttle, length < 0 ? CHUNK_SIZE : std::min<off_t>(length - total, CHUNK_SIZE));
+        ssize_t in = splice(file_fd, nullptr, pipefd[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        settle(throttle, want, in);
+        if (in < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && total == 0) {
+                close(pipefd[0]);
+                close(pipefd[1]);
+                return sendFileBuffered(data_fd, file_fd, offset, 64 * 1024, length, throttle);
+            }
+            total = -1;
+            break;
+        }
+        if (in == 0) {
+            // EOF ends a transfer to end of file, anything else came up short
+            if (length >= 0) total = fileShrank();
+            break;
+        }
+        while (in > 0) {
+            ssize_t out = splice(pipefd[0], nullptr, data_fd, nullptr, in, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0) {
+                if (errno == EINTR) continue;
+                total = -1;
+                break;
+            }
+            in -= out;
+            total += out;
+        }
+        if (total < 0) break;
+    }
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return total;
+}
+
+// Uses pread() so a shared fd's file position is never touched; streams that
+// cannot pread (pipes) fall back to read() from the current position.
+ssize_t DataTransfer::sendFileBuffered(int data_fd, int file_fd, off_t offset, size_t buf_size, off_t length,
+                                       Throttle* throttle) {
+    std::vector<char> buf(buf_size);
+    bool seekable = true;
+    ssize_t total = 0;
+    while (length < 0 || total < length) {
+        size_t want = length < 0 ? buf.size() : std::min<off_t>(length - total, buf.size());
+        ssize_t n = seekable ? pread(file_fd, buf.data(), want, offset + total) : read(file_fd, buf.data(), want);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == ESPIPE && seekable) {
+                seekable = false;
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            if (length >= 0) return fileShrank();
+            break;
+        }
+        if (!sendBuffer(data_fd, buf.data(), n, throttle)) return -1;
+        total += n;
+    }
+    return total;
+}
+
+static bool writeAll(int fd, const char* buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) {
+            errno = EIO;
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+ssize_t DataTransfer::receiveFile(int data_fd, int file_fd, off_t offset, bool direct_io, size_t buf_size,
+                                  Throttle* throttle) {
+    if (direct_io) return receiveFileDirect(data_fd, file_fd, offset, buf_size, throttle);
+    return receiveFileSplice(data_fd, file_fd, offset, throttle);
+}
+
+ssize_t DataTransfer::receiveFileSplice(int data_fd, int file_fd, off_t offset, Throttle* throttle) {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == -1) return receiveFileBuffered(data_fd, file_fd, offset, 1 << 20, throttle);
+
+    off_t pos = offset;
+    ssize_t result = 0;
+    while (true) {
+        size_t want = grant(throttle, CHUNK_SIZE);
+        ssize_t in = splice(data_fd, nullptr, pipefd[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        settle(throttle, want, in);
+        if (in < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && pos == offset) {
+                close(pipefd[0]);
+                close(pipefd[1]);
+                return receiveFileBuffered(data_fd, file_fd, offset, 1 << 20, throttle);
+            }
+            result = -1;
+            break;
+        }
+        if (in == 0) break;
+        while (in > 0) {
+            ssize_t out = splice(pipefd[0], nullptr, file_fd, &pos, in, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                if (out == 0) errno = EIO;
+                result = -1;
+                break;
+            }
+            in -= out;
+        }
+        if (result < 0) break;
+    }
+    int saved_errno = errno;
+    close(pipefd[0]);
+    close(pipefd[1]);
+    errno = saved_errno;
+    return result < 0 ? -1 : pos - offset;
+}
+
+ssize_t DataTransfer::receiveFileBuffered(int data_fd, int file_fd, off_t offset, size_t buf_size,
+                                          Throttle* throttle, const Tap& tap) {
+    std::vector<char> buf(buf_size);
+    off_t pos = offset;
+    while (true) {
+        size_t want = grant(throttle, buf.size());
+        ssize_t n = recv(data_fd, buf.data(), want, 0);
+        settle(throttle, want, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        if (tap) tap(buf.data(), n);
+        if (!writeAll(file_fd, buf.data(), n, pos)) return -1;
+        pos += n;
+    }
+    return pos - offset;
+}
+
+// O_DIRECT needs block aligned buffers, lengths and offsets. Full buffers are
+// written directly; the unaligned tail is written after dropping O_DIRECT.
+ssize_t DataTransfer::receiveFileDirect(int data_fd, int file_fd, off_t offset, size_t buf_size,
+                                        Throttle* throttle) {
+    const size_t align = 4096;
+    buf_size = std::max(align, buf_size / align * align);
+    if (offset % align != 0) return receiveFileBuffered(data_fd, file_fd, offset, buf_size, throttle);
+
+    int flags = fcntl(file_fd, F_GETFL);
+    if (fcntl(file_fd, F_SETFL, flags | O_DIRECT) == -1) {
+        Logger::log(Logger::WARNING, "O_DIRECT not supported, using buffered writes");
+        return receiveFileBuffered(data_fd, file_fd, offset, buf_size, throttle);
+    }
+
+    void* mem = nullptr;
+    if (posix_memalign(&mem, align, buf_size) != 0) return -1;
+    char* buf = static_cast<char*>(mem);
+
+    off_t pos = offset;
+    bool eof = false;
+    ssize_t result = 0;
+    while (!eof) {
+        size_t filled = 0;
+        while (filled < buf_size) {
+            size_t want = grant(throttle, buf_size - filled);
+            ssize_t n = recv(data_fd, buf + filled, want, 0);
+            settle(throttle, want, n);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                result = -1;
+                break;
+            }
+            if (n == 0) {
+                eof = true;
+                break;
+            }
+            filled += n;
+        }
+        if (result < 0) break;
+
+        size_t aligned = filled / align * align;
+        if (aligned > 0) {
+            if (!writeAll(file_fd, buf, aligned, pos)) {
+                result = -1;
+                break;
+            }
+            pos += aligned;
+        }
+        if (filled > aligned) {
+            // Only the last block of the stream can be partial
+            fcntl(file_fd, F_SETFL, flags);
+            if (!writeAll(file_fd, buf + aligned, filled - aligned, pos)) {
+                result = -1;
+                break;
+            }
+            pos += filled - aligned;
+        }
+    }
+    int saved_errno = errno;
+    free(buf);
+    fcntl(file_fd, F_SETFL, flags);
+    errno = saved_errno;
+    return result < 0 ? -1 : pos - offset;
+}
+
+#ifdef FTP_IO_URING
+
+#include "IoUring.hpp"
+
+#include <sys/mman.h>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+const unsigned URING_SLOTS = 8;              // chunks in flight per transfer
+const size_t URING_CHUNK = 256 * 1024;
+const unsigned FILE_INDEX = 0, SOCKET_INDEX = 1; // registered file slots
+
+enum UringOp : uint64_t { OP_READ = 1, OP_WRITE, OP_SEND, OP_RECV, OP_TIMEOUT };
+
+// A ring and its registered buffers. Setting one up costs far more than a
+// small transfer, so they are pooled and reused across threads.
+struct UringContext {
+    IoUring ring{URING_SLOTS * 2 + 4};
+    char* memory = nullptr;
+    bool ready = false;
+
+    UringContext() {
+        if (!ring.ok()) return;
+        void* p = mmap(nullptr, URING_SLOTS * URING_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return;
+        memory = static_cast<char*>(p);
+        iovec iov[URING_SLOTS];
+        for (unsigned i = 0; i < URING_SLOTS; ++i) iov[i] = {memory + i * URING_CHUNK, URING_CHUNK};
+        const int empty[2] = {-1, -1};
+        ready = ring.registerBuffers(iov, URING_SLOTS) && ring.registerFiles(empty, 2);
+    }
+    ~UringContext() {
+        if (memory) munmap(memory, URING_SLOTS * URING_CHUNK);
+    }
+};
+
+const size_t URING_POOL_MAX = 64; // idle contexts kept
+std::mutex uring_pool_mutex;
+std::vector<std::unique_ptr<UringContext>> uring_pool;
+
+// Takes an idle context or sets up a new one, nullptr if io_uring is unusable
+std::unique_ptr<UringContext> acquireUring() {
+    if (!IoUring::supported()) return nullptr;
+    {
+        std::lock_guard<std::mutex> lock(uring_pool_mutex);
+        if (!uring_pool.empty()) {
+            std::unique_ptr<UringContext> context = std::move(uring_pool.back());
+            uring_pool.pop_back();
+            return context;
+        }
+    }
+    std::unique_ptr<UringContext> context(new UringContext());
+    if (context->ready) return context;
+    Logger::log(Logger::WARNING, "io_uring setup failed, using the blocking transfer path");
+    return nullptr;
+}
+
+void releaseUring(std::unique_ptr<UringContext> context) {
+    std::lock_guard<std::mutex> lock(uring_pool_mutex);
+    if (uring_pool.size() < URING_POOL_MAX) uring_pool.push_back(std::move(context));
+}
+
+// One transfer on a pooled ring: registers the two fds, queues the
+// operations and waits for them. The socket's SO_SNDTIMEO/SO_RCVTIMEO is
+// applied as a linked timeout, since io_uring does not honour it.
+class UringTransfer {
+public:
+    UringTransfer(std::unique_ptr<UringContext> context, int file_fd, int socket_fd, int timeout_option)
+        : owner_(std::move(context)), ctx_(*owner_) {
+        const int fds[2] = {file_fd, socket_fd};
+        ok_ = ctx_.ring.updateFiles(0, fds, 2);
+        timeval tv{};
+        socklen_t len = sizeof(tv);
+        if (getsockopt(socket_fd, SOL_SOCKET, timeout_option, &tv, &len) == 0 && (tv.tv_sec || tv.tv_usec)) {
+            timeout_.tv_sec = tv.tv_sec;
+            timeout_.tv_nsec = tv.tv_usec * 1000;
+            has_timeout_ = true;
+        }
+    }
+
+    // Waits for everything still in flight, then drops the registered fds so
+    // closing them really closes them
+    ~UringTransfer() {
+        while (in_flight_ > 0 && wait()) reap([](UringOp, unsigned, int) {});
+        const int empty[2] = {-1, -1};
+        // A ring with operations still pending is not reused
+        if (in_flight_ == 0 && ctx_.ring.updateFiles(0, empty, 2)) releaseUring(std::move(owner_));
+    }
+
+    bool ok() const { return ok_; }
+    char* buffer(unsigned slot) const { return ctx_.memory + slot * URING_CHUNK; }
+
+    void read(unsigned slot, size_t buf_off, size_t len, off_t pos) {
+        fileOp(IORING_OP_READ_FIXED, OP_READ, slot, buf_off, len, pos);
+    }
+    void write(unsigned slot, size_t buf_off, size_t len, off_t pos) {
+        fileOp(IORING_OP_WRITE_FIXED, OP_WRITE, slot, buf_off, len, pos);
+    }
+    void send(unsigned slot, size_t buf_off, size_t len) {
+        socketOp(IORING_OP_SEND, OP_SEND, slot, buf_off, len, MSG_NOSIGNAL | MSG_WAITALL);
+    }
+    void recv(unsigned slot, size_t len) {
+        socketOp(IORING_OP_RECV, OP_RECV, slot, 0, len, 0);
+    }
+
+    // Submits what is queued and waits for one completion
+    bool wait() {
+        return ctx_.ring.submitAndWait(1);
+    }
+
+    // fn(op, slot, res) for every completion. A socket operation cut off by
+    // its timeout reports -EAGAIN, like a blocking socket would.
+    template <class Fn>
+    void reap(Fn fn) {
+        ctx_.ring.reap([&](const io_uring_cqe& cqe) {
+            --in_flight_;
+            UringOp op = static_cast<UringOp>(cqe.user_data >> 32);
+            if (op == OP_TIMEOUT) return;
+            int res = cqe.res == -ECANCELED ? -EAGAIN : cqe.res;
+            fn(op, static_cast<unsigned>(cqe.user_data & 0xffffffff), res);
+        });
+    }
+
+private:
+    std::unique_ptr<UringContext> owner_;
+    UringContext& ctx_;
+    bool ok_ = false;
+    bool has_timeout_ = false;
+    __kernel_timespec timeout_{};
+    unsigned in_flight_ = 0;
+
+    // The ring has room for two entries per slot, so sqe() cannot run out
+    io_uring_sqe* prepare(uint8_t opcode, UringOp op, unsigned slot, unsigned fd_index, size_t buf_off, size_t len) {
+        io_uring_sqe* sqe = ctx_.ring.sqe();
+        sqe->opcode = opcode;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = fd_index;
+        sqe->addr = reinterpret_cast<uint64_t>(buffer(slot) + buf_off);
+        sqe->len = static_cast<uint32_t>(len);
+        sqe->user_data = static_cast<uint64_t>(op) << 32 | slot;
+        ++in_flight_;
+        return sqe;
+    }
+
+    void fileOp(uint8_t opcode, UringOp op, unsigned slot, size_t buf_off, size_t len, off_t pos) {
+        io_uring_sqe* sqe = prepare(opcode, op, slot, FILE_INDEX, buf_off, len);
+        sqe->off = pos;
+        sqe->buf_index = static_cast<uint16_t>(slot);
+    }
+
+    void socketOp(uint8_t opcode, UringOp op, unsigned slot, size_t buf_off, size_t len, int msg_flags) {
+        io_uring_sqe* sqe = prepare(opcode, op, slot, SOCKET_INDEX, buf_off, len);
+        sqe->msg_flags = msg_flags;
+        if (!has_timeout_) return;
+        sqe->flags |= IOSQE_IO_LINK;
+        io_uring_sqe* timeout = ctx_.ring.sqe();
+        timeout->opcode = IORING_OP_LINK_TIMEOUT;
+        timeout->fd = -1;
+        timeout->addr = reinterpret_cast<uint64_t>(&timeout_);
+        timeout->len = 1;
+        timeout->user_data = static_cast<uint64_t>(OP_TIMEOUT) << 32;
+        ++in_flight_;
+    }
+};
+
+} // namespace
+
+bool DataTransfer::uringAvailable() {
+    return IoUring::supported();
+}
+
+// File chunks are read ahead into every free buffer while the oldest filled
+// one is being sent. Sends go one at a time to keep the stream in order.
+ssize_t DataTransfer::sendFileUring(int data_fd, int file_fd, off_t offset, off_t length, Throttle* throttle) {
+    struct stat st;
+    if (fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode)) return sendFile(data_fd, file_fd, offset, length, throttle);
+    std::unique_ptr<UringContext> ctx = acquireUring();
+    if (!ctx) return sendFile(data_fd, file_fd, offset, length, throttle);
+    UringTransfer transfer(std::move(ctx), file_fd, data_fd, SO_SNDTIMEO);
+    if (!transfer.ok()) return sendFile(data_fd, file_fd, offset, length, throttle);
+
+    off_t end = st.st_size;
+    if (length >= 0 && offset + length < end) end = offset + length;
+
+    enum State { Free, Reading, Filled };
+    struct Slot {
+        State state = Free;
+        off_t pos = 0;
+        size_t len = 0;  // bytes wanted, then bytes available
+        size_t done = 0; // bytes read, then bytes sent
+    } slots[URING_SLOTS];
+    uint64_t next_read = 0, next_send = 0; // slot sequence numbers, in file order
+    off_t read_pos = offset;
+    bool sending = false;
+    size_t granted = 0;
+    ssize_t sent = 0;
+    int error = 0;
+
+    while (true) {
+        while (next_read - next_send < URING_SLOTS && read_pos < end) {
+            unsigned i = next_read++ % URING_SLOTS;
+            slots[i] = Slot{Reading, read_pos, (size_t)std::min<off_t>(URING_CHUNK, end - read_pos), 0};
+            transfer.read(i, 0, slots[i].len, read_pos);
+            read_pos += slots[i].len;
+        }
+        if (next_send == next_read && read_pos >= end) break;
+        Slot& head = slots[next_send % URING_SLOTS];
+        if (!sending && head.state == Filled) {
+            granted = grant(throttle, head.len - head.done);
+            transfer.send(next_send % URING_SLOTS, head.done, granted);
+            sending = true;
+        }
+        if (!transfer.wait()) {
+            error = errno;
+            break;
+        }
+        transfer.reap([&](UringOp op, unsigned i, int res) {
+            Slot& slot = slots[i];
+            if (op == OP_READ) {
+                if (res < 0) {
+                    error = -res;
+                } else if (res == 0) {
+                    error = EIO; // the file shrank under us
+                } else if (slot.done + res == slot.len) {
+                    slot.done = 0;
+                    slot.state = Filled;
+                } else {
+                    slot.done += res;
+                    transfer.read(i, slot.done, slot.len - slot.done, slot.pos + slot.done);
+                }
+            } else if (op == OP_SEND) {
+                sending = false;
+                settle(throttle, granted, res);
+                if (res < 0) {
+                    error = -res;
+                    return;
+                }
+                slot.done += res;
+                sent += res;
+                if (slot.done == slot.len) {
+                    slot.state = Free;
+                    ++next_send;
+                }
+            }
+        });
+        if (error) break;
+    }
+    if (error) {
+        Logger::log(Logger::ERROR, std::string("io_uring send failed: ") + strerror(error));
+        errno = error;
+        return -1;
+    }
+    return sent;
+}
+
+// One receive is in flight at a time, into a free buffer; every filled
+// buffer is written at its own offset while the next receive runs
+ssize_t DataTransfer::receiveFileUring(int data_fd, int file_fd, off_t offset, Throttle* throttle) {
+    std::unique_ptr<UringContext> ctx = acquireUring();
+    if (!ctx) return receiveFile(data_fd, file_fd, offset, false, 1 << 20, throttle);
+    UringTransfer transfer(std::move(ctx), file_fd, data_fd, SO_RCVTIMEO);
+    if (!transfer.ok()) return receiveFile(data_fd, file_fd, offset, false, 1 << 20, throttle);
+
+    struct Slot {
+        bool busy = false;
+        off_t pos = 0;
+        size_t len = 0;
+        size_t done = 0;
+    } slots[URING_SLOTS];
+    off_t write_pos = offset;
+    bool receiving = false, eof = false;
+    unsigned writing = 0;
+    size_t granted = 0;
+    int error = 0;
+
+    while (true) {
+        if (!receiving && !eof) {
+            for (unsigned i = 0; i < URING_SLOTS; ++i) {
+                if (slots[i].busy) continue;
+                slots[i].busy = true;
+                granted = grant(throttle, URING_CHUNK);
+                transfer.recv(i, granted);
+                receiving = true;
+                break;
+            }
+        }
+        if (eof && writing == 0) break;
+        if (!transfer.wait()) {
+            error = errno;
+            break;
+        }
+        transfer.reap([&](UringOp op, unsigned i, int res) {
+            Slot& slot = slots[i];
+            if (op == OP_RECV) {
+                receiving = false;
+                settle(throttle, granted, res);
+                if (res <= 0) {
+                    if (res < 0) error = -res;
+                    eof = true;
+                    slot.busy = false;
+                    return;
+                }
+                slot = Slot{true, write_pos, (size_t)res, 0};
+                write_pos += res;
+                transfer.write(i, 0, slot.len, slot.pos);
+                ++writing;
+            } else if (op == OP_WRITE) {
+                if (res <= 0) {
+                    error = res < 0 ? -res : EIO;
+                    --writing;
+                    slot.busy = false;
+                    return;
+                }
+                slot.done += res;
+                if (slot.done < slot.len) {
+                    transfer.write(i, slot.done, slot.len - slot.done, slot.pos + slot.done);
+                } else {
+                    --writing;
+                    slot.busy = false;
+                }
+            }
+        });
+        if (error) break;
+    }
+    if (error) {
+        Logger::log(Logger::ERROR, std::string("io_uring receive failed: ") + strerror(error));
+        errno = error;
+        return -1;
+    }
+    return write_pos - offset;
+}
+
+#else
+
+bool DataTransfer::uringAvailable() {
+    return false;
+}
+
+ssize_t DataTransfer::sendFileUring(int data_fd, int file_fd, off_t offset, off_t length, Throttle* throttle) {
+    return sendFile(data_fd, file_fd, offset, length, throttle);
+}
+
+ssize_t DataTransfer::receiveFileUring(int data_fd, int file_fd, off_t offset, Throttle* throttle) {
+    return receiveFile(data_fd, file_fd, offset, false, 1 << 20, throttle);
+}
+
+#endif
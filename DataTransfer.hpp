@@ -0,0 +1,55 @@
+#pragma once
+#include <sys/types.h>
+#include <cstddef>
+#include <functional>
+
+class Throttle;
+
+// Moves file contents over a data connection. Every transfer takes an
+// optional Throttle that paces it and measures its rate.
+class DataTransfer {
+public:
+    // Sees every received block before it is written, e.g. to hash an upload
+    using Tap = std::function<void(const char*, size_t)>;
+
+    // Sends length bytes (-1 = up to EOF) of file_fd from offset over data_fd.
+    // Regular files go through sendfile(2), other files through splice(2) via
+    // a pipe, and a plain read/send loop is the last resort. Regular files are
+    // read at explicit offsets, so one fd can serve concurrent transfers.
+    // Returns bytes sent, -1 on error.
+    static ssize_t sendFile(int data_fd, int file_fd, off_t offset, off_t length = -1,
+                            Throttle* throttle = nullptr);
+
+    // Sends the whole buffer, retrying short writes
+    static bool sendBuffer(int data_fd, const char* buf, size_t len, Throttle* throttle = nullptr);
+
+    // pread() + send() through a user space buffer (the pre-sendfile path)
+    static ssize_t sendFileBuffered(int data_fd, int file_fd, off_t offset, size_t buf_size = 64 * 1024,
+                                    off_t length = -1, Throttle* throttle = nullptr);
+
+    // Receives from data_fd until EOF and writes it to file_fd at offset.
+    // Uses splice(2) socket -> pipe -> file, or with direct_io a buf_size
+    // aligned buffer and O_DIRECT writes. Returns bytes written, -1 on a
+    // receive or write error (errno is preserved).
+    static ssize_t receiveFile(int data_fd, int file_fd, off_t offset, bool direct_io = false,
+                               size_t buf_size = 1 << 20, Throttle* throttle = nullptr);
+
+    // recv() + pwrite() through a user space buffer
+    static ssize_t receiveFileBuffered(int data_fd, int file_fd, off_t offset, size_t buf_size = 1 << 20,
+                                       Throttle* throttle = nullptr, const Tap& tap = nullptr);
+
+    // sendFile and receiveFile through io_uring: file reads or writes and the
+    // socket sends or receives of several chunks are in flight at once, in
+    // registered buffers on registered files, with one io_uring_enter per
+    // round. Falls back to sendFile/receiveFile when built without
+    // IO_URING=1 or when the kernel refuses io_uring.
+    static ssize_t sendFileUring(int data_fd, int file_fd, off_t offset, off_t length = -1,
+                                 Throttle* throttle = nullptr);
+    static ssize_t receiveFileUring(int data_fd, int file_fd, off_t offset, Throttle* throttle = nullptr);
+    static bool uringAvailable();
+
+private:
+    static ssize_t sendFileSplice(int data_fd, int file_fd, off_t offset, off_t length, Throttle* throttle);
+    static ssize_t receiveFileSplice(int data_fd, int file_fd, off_t offset, Throttle* throttle);
+    static ssize_t receiveFileDirect(int data_fd, int file_fd, off_t offset, size_t buf_size, Throttle* throttle);
+};
@@ -0,0 +1,151 @@
+#include "DirLister.hpp"
+
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unordered_map>
+
+namespace {
+
+// Output is flushed to the sink once the buffer grows past this size
+const size_t FLUSH_SIZE = 64 * 1024;
+
+struct linux_dirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// uid/gid -> name, resolved once per listing instead of once per entry
+struct OwnerNames {
+    std::unordered_map<uid_t, std::string> users;
+    std::unordered_map<gid_t, std::string> groups;
+
+    const std::string& user(uid_t uid) {
+        auto it = users.find(uid);
+        if (it != users.end()) return it->second;
+        struct passwd pw, *res = nullptr;
+        char buf[1024];
+        std::string name = getpwuid_r(uid, &pw, buf, sizeof(buf), &res) == 0 && res ? pw.pw_name : std::to_string(uid);
+        return users.emplace(uid, name).first->second;
+    }
+
+    const std::string& group(gid_t gid) {
+        auto it = groups.find(gid);
+        if (it != groups.end()) return it->second;
+        struct group gr, *res = nullptr;
+        char buf[1024];
+        std::string name = getgrgid_r(gid, &gr, buf, sizeof(buf), &res) == 0 && res ? gr.gr_name : std::to_string(gid);
+        return groups.emplace(gid, name).first->second;
+    }
+};
+
+thread_local OwnerNames owner_names;
+thread_local std::string out_buffer;
+
+void modeString(mode_t mode, char* s) {
+    s[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : S_ISCHR(mode) ? 'c' : S_ISBLK(mode) ? 'b'
+         : S_ISFIFO(mode) ? 'p' : S_ISSOCK(mode) ? 's' : '-';
+    const char* rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; ++i) s[i + 1] = (mode & (0400 >> i)) ? rwx[i] : '-';
+    if (mode & S_ISUID) s[3] = (mode & S_IXUSR) ? 's' : 'S';
+    if (mode & S_ISGID) s[6] = (mode & S_IXGRP) ? 's' : 'S';
+    if (mode & S_ISVTX) s[9] = (mode & S_IXOTH) ? 't' : 'T';
+    s[10] = '\0';
+}
+
+} // namespace
+
+bool DirLister::listEntry(int parent_fd, const std::string& name, Format format, const Sink& sink) {
+    struct stat st;
+    if (fstatat(parent_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == -1) return false;
+    std::string& out = out_buffer;
+    out.clear();
+    formatEntry(out, parent_fd, name.c_str(), st, format);
+    return sink(out.data(), out.size());
+}
+
+bool DirLister::list(int dir_fd, Format format, const Sink& sink) {
+    std::string& out = out_buffer;
+    out.clear();
+    out.reserve(FLUSH_SIZE + 1024);
+
+    alignas(linux_dirent64) char dents[64 * 1024];
+    while (true) {
+        long n = syscall(SYS_getdents64, dir_fd, dents, sizeof(dents));
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+        for (long pos = 0; pos < n;) {
+            auto* d = reinterpret_cast<linux_dirent64*>(dents + pos);
+            pos += d->d_reclen;
+            // Hidden entries (including in-flight STOR temp files) are not listed
+            if (d->d_name[0] == '.') continue;
+
+            if (format == NLST) {
+                out.append(d->d_name).append("\r\n");
+            } else {
+                struct stat st;
+                if (fstatat(dir_fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue; // raced with unlink
+                formatEntry(out, dir_fd, d->d_name, st, format);
+            }
+            if (out.size() >= FLUSH_SIZE) {
+                if (!sink(out.data(), out.size())) return false;
+                out.clear();
+            }
+        }
+    }
+    if (!out.empty() && !sink(out.data(), out.size())) return false;
+    return true;
+}
+
+void DirLister::formatEntry(std::string& out, int dir_fd, const char* name, const struct stat& st, Format format) {
+    char line[512];
+    if (format == NLST) {
+        out.append(name).append("\r\n");
+        return;
+    }
+
+    struct tm tm;
+    if (format == MLSD) {
+        gmtime_r(&st.st_mtime, &tm);
+        const char* type = S_ISDIR(st.st_mode) ? "dir" : S_ISREG(st.st_mode) ? "file"
+                         : S_ISLNK(st.st_mode) ? "OS.unix=slink" : "OS.unix=other";
+        const char* perm = S_ISDIR(st.st_mode) ? "flcdmpe" : "adfrw";
+        int len = snprintf(line, sizeof(line), "type=%s;size=%lld;modify=%04d%02d%02d%02d%02d%02d;perm=%s;UNIX.mode=0%o; ",
+                           type, (long long)st.st_size, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                           tm.tm_hour, tm.tm_min, tm.tm_sec, perm, (unsigned)(st.st_mode & 07777));
+        out.append(line, len).append(name).append("\r\n");
+        return;
+    }
+
+    // ls -l style: recent files show the time, older ones the year
+    char mode[11];
+    modeString(st.st_mode, mode);
+    localtime_r(&st.st_mtime, &tm);
+    char date[16];
+    time_t now = time(nullptr);
+    bool recent = st.st_mtime > now - 182 * 24 * 3600 && st.st_mtime <= now + 3600;
+    strftime(date, sizeof(date), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+
+    int len = snprintf(line, sizeof(line), "%s %3lu %-8s %-8s %8lld %s ",
+                       mode, (unsigned long)st.st_nlink, owner_names.user(st.st_uid).c_str(),
+                       owner_names.group(st.st_gid).c_str(), (long long)st.st_size, date);
+    out.append(line, len).append(name);
+    if (S_ISLNK(st.st_mode)) {
+        char target[4096];
+        ssize_t tlen = readlinkat(dir_fd, name, target, sizeof(target));
+        if (tlen > 0) out.append(" -> ").append(target, tlen);
+    }
+    out.append("\r\n");
+}
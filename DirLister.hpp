@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <functional>
+#include <sys/stat.h>
+
+// In-process directory listings for LIST, NLST and MLSD. Entries are read with
+// getdents64 and fstatat relative to the directory fd, formatted into a
+// reusable buffer and handed to the sink in chunks, so big directories stream
+// out without being held in memory and without forking ls.
+class DirLister {
+public:
+    enum Format { LIST, NLST, MLSD };
+
+    // Receives formatted output, returns false to abort the listing
+    using Sink = std::function<bool(const char* data, size_t len)>;
+
+    // Lists the directory open as dir_fd (O_RDONLY). Returns false if it
+    // cannot be read or the sink fails.
+    static bool list(int dir_fd, Format format, const Sink& sink);
+
+    // Lists the single entry name of the directory parent_fd ("LIST file")
+    static bool listEntry(int parent_fd, const std::string& name, Format format, const Sink& sink);
+
+private:
+    static void formatEntry(std::string& out, int dir_fd, const char* name, const struct stat& st, Format format);
+};
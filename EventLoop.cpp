@@ -0,0 +1,225 @@
+#include "EventLoop.hpp"
+#include "FtpServer.hpp"
+#include "Session.hpp"
+#include "Logger.hpp"
+#include "ErrorHandler.hpp"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+
+namespace {
+
+// Fixed-size pool shared by all loops for the blocking part of sessions, so
+// a burst of transfers waits for a worker instead of starting threads
+class BlockingPool {
+public:
+    void start(size_t threads, size_t max_queue) {
+        max_queue_ = max_queue;
+        for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) std::thread([this]() { run(); }).detach();
+    }
+    // False if max_queue jobs are already waiting
+    bool trySubmit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queue_.size() >= max_queue_) return false;
+            queue_.push_back(std::move(job));
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+private:
+    std::deque<std::function<void()>> queue_;
+    size_t max_queue_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    void run() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return !queue_.empty(); });
+                job = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+BlockingPool blocking_pool;
+std::once_flag blocking_pool_started;
+
+} // namespace
+
+EventLoop::EventLoop(FtpServer& server, const std::vector<ListenSocket>& listen_sockets, int id)
+    : server_(server), listen_sockets_(listen_sockets), epoll_fd_(-1), id_(id) {
+    std::call_once(blocking_pool_started, [&server]() {
+        blocking_pool.start(server.config_.blocking_threads, server.config_.blocking_queue);
+    });
+}
+
+EventLoop::~EventLoop() {
+    if (epoll_fd_ != -1) close(epoll_fd_);
+}
+
+void EventLoop::run() {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1) {
+        ErrorHandler::handleError("epoll_create1 failed", true);
+    }
+
+    // Listeners are level triggered and never disarmed. Their data.ptr
+    // points into listen_sockets_, which tells them apart from sessions.
+    for (auto& ls : listen_sockets_) {
+        int flags = fcntl(ls.fd, F_GETFL, 0);
+        fcntl(ls.fd, F_SETFL, flags | O_NONBLOCK);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = &ls;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, ls.fd, &ev) == -1) {
+            ErrorHandler::handleError("epoll_ctl on listen socket failed", true);
+        }
+    }
+    const ListenSocket* first = listen_sockets_.data();
+    const ListenSocket* last = first + listen_sockets_.size();
+    Logger::log(Logger::INFO, "Event loop " + std::to_string(id_) + " started.");
+
+    // Wake up once a second to close idle sessions
+    const int timeout_ms = server_.config_.idle_timeout > 0 ? 1000 : -1;
+    epoll_event events[64];
+    while (true) {
+        int n = epoll_wait(epoll_fd_, events, 64, timeout_ms);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            ErrorHandler::handleError("epoll_wait failed");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            auto* ls = static_cast<const ListenSocket*>(events[i].data.ptr);
+            if (ls >= first && ls < last) {
+                acceptClients(*ls);
+            } else {
+                onReadable(static_cast<Session*>(events[i].data.ptr));
+            }
+        }
+        if (timeout_ms != -1) closeIdleSessions();
+    }
+}
+
+void EventLoop::acceptClients(const ListenSocket& listen_socket) {
+    while (true) {
+        sockaddr_storage client_addr{};
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept4(listen_socket.fd, (sockaddr*)&client_addr, &client_len, SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EMFILE || errno == ENFILE) FtpServer::shedConnection(listen_socket.fd);
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                Logger::log(Logger::ERROR, "Accept failed");
+            return;
+        }
+        Session* session = new Session();
+        if (!server_.initSession(*session, client_fd, client_addr, listen_socket.listener)) {
+            delete session;
+            continue;
+        }
+
+        server_.sendWelcome(*session);
+        if (!arm(session, EPOLL_CTL_ADD)) {
+            Logger::log(Logger::ERROR, "epoll_ctl failed for new client");
+            server_.endSession(*session);
+            delete session;
+        }
+    }
+}
+
+// Sessions are registered EPOLLONESHOT: after an event fires the fd stays
+// disarmed until it is re-armed, so only one thread ever touches a session.
+bool EventLoop::arm(Session* session, int op) {
+    {
+        std::lock_guard<std::mutex> lock(waiting_mutex_);
+        waiting_[session] = std::chrono::steady_clock::now();
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = session;
+    return epoll_ctl(epoll_fd_, op, session->client_fd, &ev) == 0;
+}
+
+void EventLoop::onReadable(Session* session) {
+    {
+        std::lock_guard<std::mutex> lock(waiting_mutex_);
+        waiting_.erase(session);
+    }
+    ssize_t received = server_.readControl(*session, true);
+    if (received <= 0) {
+        if (received == -1 && (errno == EAGAIN || errno == EINTR)) {
+            arm(session, EPOLL_CTL_MOD);
+            return;
+        }
+        Logger::log(Logger::INFO, "Connection closed by client or error occurred.");
+        closeSession(session);
+        return;
+    }
+
+    switch (server_.processInput(*session, false)) {
+    case FtpServer::InputResult::Idle:
+        if (!arm(session, EPOLL_CTL_MOD)) closeSession(session);
+        break;
+    case FtpServer::InputResult::Closed:
+        closeSession(session);
+        break;
+    case FtpServer::InputResult::Blocked:
+        // The rest of the buffered input, including the transfer, runs off the loop
+        if (!blocking_pool.trySubmit([this, session]() {
+                if (server_.processInput(*session, true) == FtpServer::InputResult::Closed) {
+                    closeSession(session);
+                } else if (!arm(session, EPOLL_CTL_MOD)) {
+                    closeSession(session);
+                }
+            })) {
+            server_.sendBusy(*session);
+            closeSession(session);
+        }
+        break;
+    }
+}
+
+// Runs on the loop thread between batches of events. A waiting session is
+// not being handled by any thread, so it can be closed here.
+void EventLoop::closeIdleSessions() {
+    auto deadline = std::chrono::steady_clock::now() - std::chrono::seconds(server_.config_.idle_timeout);
+    std::vector<Session*> idle;
+    {
+        std::lock_guard<std::mutex> lock(waiting_mutex_);
+        for (const auto& entry : waiting_) {
+            if (entry.second < deadline) idle.push_back(entry.first);
+        }
+    }
+    for (Session* session : idle) {
+        server_.sendIdleTimeout(*session);
+        closeSession(session);
+    }
+}
+
+void EventLoop::closeSession(Session* session) {
+    {
+        std::lock_guard<std::mutex> lock(waiting_mutex_);
+        waiting_.erase(session);
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, session->client_fd, nullptr);
+    std::string peer = session->client_ip + ":" + std::to_string(session->client_port);
+    server_.endSession(*session);
+    delete session;
+    Logger::log(Logger::INFO, "Client disconnected: " + peer);
+}
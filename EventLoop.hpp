@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class FtpServer;
+struct Session;
+
+// One epoll loop per worker thread. Each loop owns its own listening socket
+// per listener (SO_REUSEPORT lets the kernel spread new connections across loops) and
+// drives its control connections as a state machine. Commands that move data
+// block on the data connection, so they are handed to a shared pool of
+// blocking workers and the session is re-armed once the transfer finished.
+class EventLoop {
+public:
+    struct ListenSocket {
+        int fd;
+        int listener; // index into the server's listeners
+    };
+
+    EventLoop(FtpServer& server, const std::vector<ListenSocket>& listen_sockets, int id);
+    ~EventLoop();
+    void run();
+
+private:
+    FtpServer& server_;
+    std::vector<ListenSocket> listen_sockets_;
+    int epoll_fd_;
+    int id_;
+
+    // Sessions waiting for a command, with the time they were armed.
+    // Sessions running a transfer are not listed and never time out here.
+    std::unordered_map<Session*, std::chrono::steady_clock::time_point> waiting_;
+    std::mutex waiting_mutex_;
+
+    void acceptClients(const ListenSocket& listen_socket);
+    void onReadable(Session* session);
+    bool arm(Session* session, int op);
+    void closeSession(Session* session);
+    void closeIdleSessions();
+};
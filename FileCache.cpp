@@ -0,0 +1,96 @@
+#include "FileCache.hpp"
+#include "Logger.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+
+FileCache::Mapping::~Mapping() {
+    if (data) munmap(const_cast<char*>(data), size);
+}
+
+FileCache::FileCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+FileCache::Handle FileCache::lookup(const std::string& path, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) return nullptr;
+
+    auto matches = [&st](const Entry& e) {
+        return e.dev == st.st_dev && e.ino == st.st_ino && e.size == st.st_size &&
+               e.mtime.tv_sec == st.st_mtim.tv_sec && e.mtime.tv_nsec == st.st_mtim.tv_nsec;
+    };
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = entries_.find(path);
+    if (it != entries_.end()) {
+        if (matches(*it->second)) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            ++stats_.hits;
+            return it->second->mapping;
+        }
+        eraseLocked(it->second); // file changed
+    }
+    ++stats_.misses;
+
+    // Only files requested before are mapped, one-off downloads stay on sendfile
+    if ((size_t)st.st_size > maxEntrySize()) return nullptr;
+    if (candidates_.size() >= MAX_CANDIDATES) candidates_.clear();
+    if (++candidates_[path] < 2) return nullptr;
+    candidates_.erase(path);
+
+    // MAP_POPULATE reads the whole file; lookups of other files must not
+    // wait behind that I/O
+    lock.unlock();
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (data == MAP_FAILED) {
+        Logger::log(Logger::WARNING, "mmap " + path + " failed: " + strerror(errno));
+        return nullptr;
+    }
+    auto mapping = std::make_shared<Mapping>();
+    mapping->data = static_cast<const char*>(data);
+    mapping->size = st.st_size;
+    lock.lock();
+
+    // Another lookup may have mapped the same file meanwhile
+    it = entries_.find(path);
+    if (it != entries_.end()) {
+        if (matches(*it->second)) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->mapping;
+        }
+        eraseLocked(it->second);
+    }
+
+    while (!lru_.empty() && stats_.bytes + mapping->size > max_bytes_) {
+        eraseLocked(std::prev(lru_.end()));
+        ++stats_.evictions;
+    }
+    stats_.bytes += mapping->size;
+    lru_.push_front(Entry{path, st.st_dev, st.st_ino, st.st_size, st.st_mtim, mapping});
+    entries_[path] = lru_.begin();
+    return mapping;
+}
+
+void FileCache::addServed(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.bytes_served += bytes;
+}
+
+void FileCache::invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(path);
+    if (it != entries_.end()) eraseLocked(it->second);
+}
+
+void FileCache::eraseLocked(std::list<Entry>::iterator it) {
+    stats_.bytes -= it->mapping->size;
+    entries_.erase(it->path);
+    lru_.erase(it);
+}
+
+FileCache::Stats FileCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats st = stats_;
+    st.entries = entries_.size();
+    return st;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+// Keeps hot files mapped for RETR. A file is mapped on its second request
+// and then served to every concurrent RETR from the same read-only mapping.
+// Entries are keyed on resolved path and validated against inode, size and
+// mtime; total mapped size is bounded by max_bytes with LRU eviction. An
+// evicted mapping stays alive until the last transfer using it finishes.
+class FileCache {
+public:
+    struct Mapping {
+        const char* data = nullptr;
+        size_t size = 0;
+        ~Mapping();
+    };
+    using Handle = std::shared_ptr<const Mapping>;
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t bytes_served = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+
+    explicit FileCache(size_t max_bytes = 0);
+
+    bool enabled() const { return max_bytes_ > 0; }
+
+    // Returns the mapping of the regular file open as fd at path, mapping it
+    // if it is hot and fits. nullptr means serve it from fd instead.
+    Handle lookup(const std::string& path, int fd);
+
+    void addServed(uint64_t bytes);
+    void invalidate(const std::string& path);
+
+    // Largest single file worth mapping
+    size_t maxEntrySize() const { return max_bytes_ / 4; }
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        std::string path;
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        struct timespec mtime;
+        Handle mapping;
+    };
+    static const size_t MAX_CANDIDATES = 4096;
+
+    size_t max_bytes_;
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_; // front = most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+    std::unordered_map<std::string, uint32_t> candidates_; // misses not yet mapped
+    Stats stats_;
+
+    void eraseLocked(std::list<Entry>::iterator it);
+};
@@ -0,0 +1,180 @@
+#include "FileHash.hpp"
+
+#include <openssl/evp.h>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#endif
+
+namespace {
+
+const char* const NAMES[] = {"CRC32", "CRC32C", "MD5", "SHA-1", "SHA-256"};
+static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == FileHash::ALGORITHM_COUNT, "NAMES must follow Algorithm");
+const size_t HEX_LENGTHS[] = {8, 8, 32, 40, 64};
+static_assert(sizeof(HEX_LENGTHS) / sizeof(HEX_LENGTHS[0]) == FileHash::ALGORITHM_COUNT,
+              "HEX_LENGTHS must follow Algorithm");
+
+struct Crc32cTable {
+    uint32_t t[256];
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+
+uint32_t crc32cTable(uint32_t crc, const unsigned char* p, size_t len) {
+    static const Crc32cTable table;
+    while (len--) crc = table.t[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    uint32_t c32 = (uint32_t)c;
+    for (; len > 0; --len) c32 = _mm_crc32_u8(c32, *p++);
+    return c32;
+}
+bool hasHardwareCrc() {
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t len) {
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    for (; len > 0; --len) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+bool hasHardwareCrc() {
+    return true;
+}
+#else
+uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t len) {
+    return crc32cTable(crc, p, len);
+}
+bool hasHardwareCrc() {
+    return false;
+}
+#endif
+
+const EVP_MD* digestOf(FileHash::Algorithm algorithm) {
+    switch (algorithm) {
+    case FileHash::MD5: return EVP_md5();
+    case FileHash::SHA1: return EVP_sha1();
+    case FileHash::SHA256: return EVP_sha256();
+    default: return nullptr;
+    }
+}
+
+} // namespace
+
+const char* FileHash::name(Algorithm algorithm) {
+    return NAMES[algorithm];
+}
+
+bool FileHash::parse(std::string_view name, Algorithm& algorithm) {
+    for (int i = 0; i < ALGORITHM_COUNT; ++i) {
+        if (name.size() == strlen(NAMES[i]) && strncasecmp(name.data(), NAMES[i], name.size()) == 0) {
+            algorithm = static_cast<Algorithm>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t FileHash::hexLength(Algorithm algorithm) {
+    return HEX_LENGTHS[algorithm];
+}
+
+uint32_t FileHash::crc32c(uint32_t crc, const void* data, size_t len) {
+    static const bool hardware = hasHardwareCrc();
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    crc = hardware ? crc32cHardware(crc, p, len) : crc32cTable(crc, p, len);
+    return ~crc;
+}
+
+FileHash::Hasher::Hasher(Algorithm algorithm) : algorithm_(algorithm) {
+    if (const EVP_MD* md = digestOf(algorithm)) {
+        ctx_ = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(ctx_, md, nullptr);
+    }
+}
+
+FileHash::Hasher::~Hasher() {
+    if (ctx_) EVP_MD_CTX_free(ctx_);
+}
+
+void FileHash::Hasher::update(const void* data, size_t len) {
+    if (ctx_) {
+        EVP_DigestUpdate(ctx_, data, len);
+    } else if (algorithm_ == CRC32C) {
+        crc_ = crc32c(crc_, data, len);
+    } else {
+        // zlib's crc32 takes 32-bit lengths
+        const Bytef* p = static_cast<const Bytef*>(data);
+        for (size_t done = 0; done < len;) {
+            uInt n = (uInt)std::min<size_t>(len - done, 1u << 30);
+            crc_ = (uint32_t)::crc32(crc_, p + done, n);
+            done += n;
+        }
+    }
+}
+
+std::string FileHash::Hasher::hex() {
+    char buf[2 * EVP_MAX_MD_SIZE + 1];
+    if (!ctx_) {
+        snprintf(buf, sizeof(buf), "%08x", crc_);
+        return buf;
+    }
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    EVP_DigestFinal_ex(ctx_, md, &len);
+    for (unsigned int i = 0; i < len; ++i) snprintf(buf + 2 * i, 3, "%02x", md[i]);
+    return std::string(buf, 2 * len);
+}
+
+bool FileHash::hashFile(int fd, Algorithm algorithm, off_t offset, off_t length, std::string& hex) {
+    posix_fadvise(fd, offset, length < 0 ? 0 : length, POSIX_FADV_SEQUENTIAL);
+    Hasher hasher(algorithm);
+    std::vector<char> buf(256 * 1024);
+    off_t pos = offset;
+    while (length < 0 || pos < offset + length) {
+        size_t want = buf.size();
+        if (length >= 0) want = std::min<off_t>(want, offset + length - pos);
+        ssize_t n = pread(fd, buf.data(), want, pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) {
+            if (length >= 0) return false;
+            break;
+        }
+        hasher.update(buf.data(), n);
+        pos += n;
+    }
+    hex = hasher.hex();
+    return true;
+}
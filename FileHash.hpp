@@ -0,0 +1,47 @@
+#pragma once
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+// File digests for HASH (draft-bryan-ftpext-hash) and XCRC/XMD5/XSHA256
+class FileHash {
+public:
+    enum Algorithm { CRC32, CRC32C, MD5, SHA1, SHA256, ALGORITHM_COUNT };
+
+    // Names as used by HASH, e.g. "SHA-256"
+    static const char* name(Algorithm algorithm);
+    // Case-insensitive, false for an unknown name
+    static bool parse(std::string_view name, Algorithm& algorithm);
+    // Length of the digest as returned by Hasher::hex()
+    static size_t hexLength(Algorithm algorithm);
+
+    // CRC-32C (Castagnoli). Uses the SSE4.2 / ARMv8 crc32c instructions
+    // when the CPU has them, a table otherwise.
+    static uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+    // Incremental digest, hex() ends it
+    class Hasher {
+    public:
+        explicit Hasher(Algorithm algorithm);
+        ~Hasher();
+        Hasher(const Hasher&) = delete;
+        Hasher& operator=(const Hasher&) = delete;
+
+        void update(const void* data, size_t len);
+        // Lower-case hex, CRCs as 8 digits
+        std::string hex();
+
+    private:
+        Algorithm algorithm_;
+        uint32_t crc_ = 0;
+        EVP_MD_CTX* ctx_ = nullptr;
+    };
+
+    // Digest of length bytes of fd from offset (-1 = to EOF). False on a
+    // read error or if the file ends before the range does.
+    static bool hashFile(int fd, Algorithm algorithm, off_t offset, off_t length, std::string& hex);
+};
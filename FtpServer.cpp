@@ -1,394 +1,1734 @@
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <limits.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <cerrno>
 #include <cstdlib>
 #include <cstdio>
 #include <vector>
 #include <sstream>
-#include <libgen.h> // dirname
-#include <cstring>  // for strdup
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <random>
 
 #include "FtpServer.hpp"
 #include "Logger.hpp"
 #include "ErrorHandler.hpp"
 #include "CommandParser.hpp"
+#include "EventLoop.hpp"
+#include "DataTransfer.hpp"
+#include "Compression.hpp"
+#include "Tls.hpp"
+#include "DirLister.hpp"
+#include "NetUtil.hpp"
+#include "Metrics.hpp"
 
-FtpServer::FtpServer(int port, const std::string& root_dir)
-    : port_(port), server_fd_(-1), root_dir_(root_dir) {
+FtpServer::FtpServer(const ServerConfig& config)
+    : config_(config), port_(config.port), paths_(config.root_dir),
+      userauth_(config.auth_threads, config.auth_queue),
+      listing_cache_(config.listing_cache_bytes),
+      pasv_ports_(config.pasv_min_port, config.pasv_max_port),
+      file_cache_(config.file_cache_bytes),
+      admission_(config.max_sessions, config.max_sessions_per_ip, config.max_sessions_per_user),
+      hash_index_(config.hash_index, config.hash_index_entries) {
 
-    addr = {};
-    addrlen = sizeof(addr);
+    if (config_.rate_limit > 0) global_bucket_ = std::make_shared<TokenBucket>(config_.rate_limit, config_.rate_burst);
 
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port_);
+    if (!config_.tls_certificate.empty() && !tls_.init(config_.tls_certificate, config_.tls_private_key, config_.ktls))
+        ErrorHandler::handleError("TLS setup failed", config_.tls_required);
+    if (config_.tls_required && !tls_.enabled())
+        ErrorHandler::handleError("tls_required needs tls_certificate", true);
+
+    listeners_ = config_.listeners;
+    if (listeners_.empty()) {
+        ListenSpec spec;
+        spec.port = port_;
+        listeners_.push_back(spec);
+    }
 }
 
 FtpServer::~FtpServer() {
-    if (server_fd_ != -1) {
-        close(server_fd_);
+    for (int fd : listen_fds_) {
+        close(fd);
     }
 }
 
 void FtpServer::run() {
 
     // load userfile
-    if (!userauth_.loadFromFile("users.txt")) {
-        Logger::log(Logger::ERROR, "Failed to load user file users.txt");
+    if (!userauth_.loadFromFile(config_.users_file)) {
+        Logger::log(Logger::ERROR, "Failed to load user file " + config_.users_file);
         return;
     }
 
+    if (config_.io_uring && !DataTransfer::uringAvailable())
+        Logger::log(Logger::WARNING, "io_uring requested but not available, using sendfile/splice");
+    Compression::init(config_.deflate_level, config_.deflate_threads);
+
+    startSignalThread();
+    std::thread([this]() { watchUsersFile(); }).detach();
+    if (config_.metrics_listen.port > 0) {
+        int fd = createListenSocket(config_.metrics_listen, false);
+        std::thread([this, fd]() { serveMetrics(fd); }).detach();
+    }
+
+    if (config_.event_loop)
+        runEventLoops();
+    else
+        runThreadPerClient();
+}
+
+// Returns the listening fd, or -1 if reuse_port was requested but SO_REUSEPORT is unavailable
+int FtpServer::createListenSocket(const ListenSpec& spec, bool reuse_port) {
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    if (!NetUtil::parseAddress(spec.address, spec.port, addr, addrlen)) {
+        ErrorHandler::handleError("Invalid listen address " + spec.address, true);
+    }
+
     // 1. Create socket
-    server_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd_ == -1) {
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
         ErrorHandler::handleError("Failed to create socket", true);
     }
-
     Logger::log(Logger::INFO, "Socket created.");
 
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // IPv6 listeners only take IPv6, so [::] and 0.0.0.0 can be configured side by side
+    if (addr.ss_family == AF_INET6) setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one));
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+        close(fd);
+        return -1;
+    }
+
     // 2. Bind to address
-    if (bind(server_fd_, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-        close(server_fd_);
-        server_fd_ = -1;
-        ErrorHandler::handleError("Bind failed", true);
+    if (bind(fd, (struct sockaddr*)&addr, addrlen) == -1) {
+        close(fd);
+        ErrorHandler::handleError("Bind to " + spec.address + ":" + std::to_string(spec.port) + " failed", true);
     }
     Logger::log(Logger::INFO, "Bind successful.");
 
     // 3. Listen for connections
-    if (listen(server_fd_, 5) == -1) {
-        std::cerr << "Listen failed\n";
-        close(server_fd_);
-        server_fd_ = -1;
+    if (listen(fd, config_.listen_backlog) == -1) {
+        close(fd);
         ErrorHandler::handleError("Listen failed", true);
     }
-    Logger::log(Logger::INFO, "FTP server Listening on port " + std::to_string(port_) + "...");
+    Logger::log(Logger::INFO, "FTP server Listening on " + spec.address + ":" + std::to_string(spec.port) + "...");
+    listen_fds_.push_back(fd);
+    return fd;
+}
+
+// Opens `shards` sockets for one listener with SO_REUSEPORT so the kernel
+// spreads connections over them; falls back to a single shared socket.
+std::vector<int> FtpServer::createListenShards(const ListenSpec& spec, int shards) {
+    std::vector<int> fds;
+    for (int i = 0; i < shards; ++i) {
+        int fd = createListenSocket(spec, shards > 1);
+        if (fd == -1) {
+            Logger::log(Logger::WARNING, "SO_REUSEPORT unavailable, sharing one listening socket");
+            if (fds.empty()) fds.push_back(createListenSocket(spec, false));
+            break;
+        }
+        fds.push_back(fd);
+    }
+    return fds;
+}
+
+bool FtpServer::initSession(Session& session, int client_fd, const sockaddr_storage& client_addr, int listener) {
+    session.client_fd = client_fd;
+    session.client_ip = NetUtil::addressString(client_addr);
+    session.client_port = NetUtil::port(client_addr);
+    session.listener = listener;
+    if (!admission_.admitClient(session.client_ip)) {
+        Metrics::add(Metrics::SessionsRejected);
+        static const char reply[] = "421 Too many connections, try again later\r\n";
+        send(client_fd, reply, sizeof(reply) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(client_fd);
+        session.client_fd = -1;
+        Logger::log(Logger::WARNING, "Refused client " + session.client_ip + ": session limit reached");
+        return false;
+    }
+    session.admitted = true;
+    Metrics::add(Metrics::SessionsAccepted);
+    // Replies are already batched into one writev. With Nagle, the 226 after
+    // a transfer would wait for the client's delayed ACK of the 150.
+    int one = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (config_.data_timeout > 0) {
+        // A client that stops reading must not block a thread writing replies
+        timeval tv{config_.data_timeout, 0};
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    if (config_.session_rate_limit > 0)
+        session.session_bucket = std::make_shared<TokenBucket>(config_.session_rate_limit, config_.rate_burst);
+    Logger::log(Logger::INFO, "Client connected: " + session.client_ip + ":" + std::to_string(session.client_port));
+    return true;
+}
+
+// Spare descriptor for shedConnection. Opened at startup: by the time it is
+// needed, there is none left to open.
+static int reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+void FtpServer::shedConnection(int listen_fd) {
+    static std::mutex mutex;
+    static std::time_t last_log = 0;
+    static uint64_t refused = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (reserve_fd != -1) close(reserve_fd);
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd != -1) {
+        static const char reply[] = "421 Server overloaded, try again later\r\n";
+        send(fd, reply, sizeof(reply) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(fd);
+    }
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    // At most one line a second, this lasts until descriptors free up
+    ++refused;
+    std::time_t now = std::time(nullptr);
+    if (now != last_log) {
+        Logger::log(Logger::WARNING, "Out of file descriptors, refused " + std::to_string(refused) + " clients");
+        last_log = now;
+        refused = 0;
+    }
+}
 
+void FtpServer::acceptLoop(int listen_fd, int listener) {
     // 4. Accept connections in a loop (multi-client)
     while (true) {
-        struct sockaddr_in client_addr{};
+        sockaddr_storage client_addr{};
         socklen_t client_len = sizeof(client_addr);
-        int client_fd = accept(server_fd_, (struct sockaddr*)&client_addr, &client_len);
+        int client_fd = accept4(listen_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_CLOEXEC);
         if (client_fd == -1) {
-            Logger::log(Logger::ERROR, "Accept failed");
+            if (errno == EMFILE || errno == ENFILE) shedConnection(listen_fd);
+            else Logger::log(Logger::ERROR, "Accept failed");
             continue;
         }
-        std::string client_ip = inet_ntoa(client_addr.sin_addr);
-        int client_port = ntohs(client_addr.sin_port);
-        Logger::log(Logger::INFO, "Client connected: " + client_ip + ":" + std::to_string(client_port));
+        Session session;
+        if (!initSession(session, client_fd, client_addr, listener)) continue;
 
         // Launch a thread for each client
-        std::thread([this, client_fd, client_ip, client_port]() {
-            handleSession(client_fd, client_ip, client_port);
-            Logger::log(Logger::INFO, "Client disconnected: " + client_ip + ":" + std::to_string(client_port));
+        std::thread([this, session = std::move(session)]() mutable {
+            handleSession(session);
+            Logger::log(Logger::INFO, "Client disconnected: " + session.client_ip + ":" + std::to_string(session.client_port));
         }).detach();
     }
-   
 }
 
-void FtpServer::handleSession(int client_fd, const std::string& client_ip, int client_port) {
-    // change to ftp_root
-    //chdir(root_dir_.c_str());
+void FtpServer::runThreadPerClient() {
+    int shards = std::max(1, config_.accept_threads);
+    std::vector<std::thread> threads;
+    for (size_t l = 0; l < listeners_.size(); ++l) {
+        for (int fd : createListenShards(listeners_[l], shards)) {
+            threads.emplace_back(&FtpServer::acceptLoop, this, fd, (int)l);
+        }
+    }
+    for (auto& t : threads) t.join();
+}
+
+void FtpServer::runEventLoops() {
+    int workers = config_.worker_threads > 0 ? config_.worker_threads
+                                             : (int)std::max(1u, std::thread::hardware_concurrency());
+
+    // Every loop gets its own socket per listener (SO_REUSEPORT), the kernel
+    // balances accepts between them. Without it the loops share one socket.
+    std::vector<std::vector<EventLoop::ListenSocket>> loop_sockets(workers);
+    for (size_t l = 0; l < listeners_.size(); ++l) {
+        std::vector<int> fds = createListenShards(listeners_[l], workers);
+        for (int i = 0; i < workers; ++i) {
+            loop_sockets[i].push_back({fds[i % fds.size()], (int)l});
+        }
+    }
+
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    for (int i = 0; i < workers; ++i) {
+        loops.push_back(std::make_unique<EventLoop>(*this, loop_sockets[i], i));
+    }
+    Logger::log(Logger::INFO, "Running " + std::to_string(workers) + " event loops.");
+
+    std::vector<std::thread> threads;
+    for (auto& loop : loops) {
+        threads.emplace_back([&loop]() { loop->run(); });
+    }
+    for (auto& t : threads) t.join();
+}
+
+void FtpServer::handleSession(Session& session) {
+    sendWelcome(session);
+    if (config_.idle_timeout > 0) {
+        timeval tv{config_.idle_timeout, 0};
+        setsockopt(session.client_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+
+    while (true) {
+        ssize_t received = readControl(session, false);
+        if (received == -1 && errno == EINTR) continue;
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            sendIdleTimeout(session);
+            break;
+        }
+        if (received <= 0) {
+            Logger::log(Logger::INFO, "Connection closed by client or error occurred.");
+            break;
+        }
+        if (processInput(session, true) == InputResult::Closed)
+            break;
+    }
+    endSession(session);
+}
+
+void FtpServer::sendIdleTimeout(Session& session) {
+    queueReply(session, "421 Timeout, closing control connection\r\n");
+    flushReplies(session);
+    Logger::log(Logger::INFO, "Idle timeout: " + session.client_ip + ":" + std::to_string(session.client_port));
+}
+
+void FtpServer::sendBusy(Session& session) {
+    queueReply(session, "421 Too many transfers in progress, closing control connection\r\n");
+    flushReplies(session);
+    Logger::log(Logger::WARNING, "Blocking queue full, closing " + session.client_ip + ":" +
+                                     std::to_string(session.client_port));
+}
 
+void FtpServer::sendWelcome(Session& session) {
     // Send welcome message
-    const char* welcome = "220 Simple FTP Server Ready\r\n";
-    if(send(client_fd, welcome, strlen(welcome), 0)==-1)
+    queueReply(session, "220 Simple FTP Server Ready\r\n");
+    if (!flushReplies(session))
         ErrorHandler::handleError("Failed to send welcome message");
     else
         Logger::log(Logger::INFO, "Welcome message sent.");
+}
 
+ssize_t FtpServer::readControl(Session& session, bool dont_wait) {
     char buf[4096];
-    bool running = true;
-    bool logged_in = false;
-    std::string last_user;
-    DataConn dataconn;
+    if (!session.tls) {
+        ssize_t n = recv(session.client_fd, buf, sizeof(buf), dont_wait ? MSG_DONTWAIT : 0);
+        if (n > 0) session.in_buffer.append(buf, n);
+        return n;
+    }
+    // OpenSSL may hold decrypted input that epoll cannot see, take all of it
+    ssize_t total = 0;
+    do {
+        ssize_t n = Tls::read(session.tls, buf, sizeof(buf), dont_wait);
+        if (n <= 0) return total > 0 ? total : n;
+        session.in_buffer.append(buf, n);
+        total += n;
+    } while (Tls::pending(session.tls));
+    return total;
+}
 
-    while (running) {
-        ssize_t received = recv(client_fd, buf, sizeof(buf) - 1, 0);
-        if (received <= 0) {
-            Logger::log(Logger::INFO, "Connection closed by client or error occurred.");
+// Runs every complete line in the session's input buffer. Commands arriving
+// pipelined in one segment are all handled in one pass and their replies go
+// out in a single writev. Without allow_blocking, processing stops in front
+// of a command that would block on a data connection.
+FtpServer::InputResult FtpServer::processInput(Session& session, bool allow_blocking) {
+    InputResult result = InputResult::Idle;
+    size_t pos = 0;
+    while (true) {
+        size_t eol = session.in_buffer.find('\n', pos);
+        if (eol == std::string::npos) break;
+        std::string_view line(session.in_buffer.data() + pos, eol - pos);
+        Command command = CommandParser::parse(line);
+        if (!allow_blocking && mayBlock(session, command)) {
+            result = InputResult::Blocked;
             break;
         }
-        buf[received] = '\0';
-        std::string input(buf);
-        Logger::log(Logger::INFO, "Received: " + input);
-
-        // Parse command and argument
-        auto [cmd, arg] = CommandParser::parse(input);
-
-        if (cmd == "USER") {
-            last_user = arg;
-            if (userauth_.checkPassword(last_user, "")) {
-                std::string reply = "230 User logged in, proceed\r\n"; // In case of empty password allowed
-                logged_in = true;
-                send(client_fd, reply.c_str(), reply.length(), 0);
-            } else {
-                std::string reply = "331 Username ok, need password\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-            }
-        } else if (cmd == "PASS") {
-            if (last_user.empty()) {
-                std::string reply = "503 Login with USER first\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-            } else if (userauth_.checkPassword(last_user, arg)) {
-                logged_in = true;
-                std::string reply = "230 User logged in, proceed\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-            } else {
-                std::string reply = "530 Login incorrect\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                last_user.clear();
-            }
-        } else if (cmd == "NOOP") {
-            std::string reply = "200 NOOP ok\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
-        } else if (cmd == "QUIT") {
-            std::string reply = "221 Goodbye\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
-            running = false;
-        } else if (!logged_in && cmd != "QUIT" && cmd != "NOOP") {
-            std::string reply = "530 Please login with USER and PASS\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
-        } else if (cmd == "PASV") {
-            if (openPassiveDataConn(dataconn, client_fd)) {
-                // Send PASV reply (RFC 959 format: 227 Entering Passive Mode (h1,h2,h3,h4,p1,p2))
-                // Use local IP, e.g., 127,0,0,1
-                int p1 = dataconn.port / 256;
-                int p2 = dataconn.port % 256;
-                std::string reply = "227 Entering Passive Mode (127,0,0,1," +
-                    std::to_string(p1) + "," + std::to_string(p2) + ")\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
+        pos = eol + 1;
+        Logger::log(Logger::INFO, "Received: " + std::string(line));
+        if (!processCommand(session, command)) {
+            result = InputResult::Closed;
+            break;
+        }
+        if (command.id == CommandId::AUTH && session.tls) {
+            // Plaintext pipelined behind AUTH TLS must not run as if it had
+            // arrived encrypted
+            pos = session.in_buffer.size();
+            break;
+        }
+    }
+    session.in_buffer.erase(0, pos);
+    if (session.in_buffer.size() > MAX_LINE_LENGTH) {
+        queueReply(session, "500 Command line too long\r\n");
+        session.in_buffer.clear();
+    }
+    if (!flushReplies(session)) result = InputResult::Closed;
+    return result;
+}
+
+// Transfers block on the data connection, PASS on a salted hash
+bool FtpServer::mayBlock(const Session& session, const Command& command) const {
+    if (commandSpec(command.id).transfer) return true;
+    switch (command.id) {
+    case CommandId::HASH:
+    case CommandId::XCRC:
+    case CommandId::XMD5:
+    case CommandId::XSHA256: return true; // reads the whole range on an index miss
+    case CommandId::PASS: return userauth_.slowHash(session.last_user);
+    case CommandId::AUTH: return tls_.enabled(); // waits for the handshake
+    default: return false;
+    }
+}
+
+void FtpServer::queueReply(Session& session, const std::string& reply) {
+    session.replies.push_back(reply);
+}
+
+// Writes all queued replies with as few writev calls as possible, or with
+// TLS as one record
+bool FtpServer::flushReplies(Session& session) {
+    auto& replies = session.replies;
+    if (session.tls) {
+        std::string out;
+        for (const std::string& reply : replies) out += reply;
+        replies.clear();
+        return Tls::write(session.tls, out.data(), out.size());
+    }
+    size_t first = 0;
+    size_t offset = 0; // bytes of replies[first] already written
+    bool ok = true;
+    while (first < replies.size()) {
+        iovec iov[IOV_MAX];
+        int count = 0;
+        for (size_t i = first; i < replies.size() && count < IOV_MAX; ++i, ++count) {
+            size_t skip = i == first ? offset : 0;
+            iov[count].iov_base = const_cast<char*>(replies[i].data()) + skip;
+            iov[count].iov_len = replies[i].size() - skip;
+        }
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(session.client_fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        while (n > 0 && first < replies.size()) {
+            size_t left = replies[first].size() - offset;
+            if ((size_t)n >= left) {
+                n -= left;
+                ++first;
+                offset = 0;
             } else {
-                std::string reply = "425 Can't open data connection\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-            }
-        } else if (cmd == "LIST") {
-            if (!dataconn.ready) {
-                std::string reply = "425 Use PASV first\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                continue;
-            }
-            int data_fd = acceptPassiveDataConn(dataconn);
-            if (data_fd == -1) {
-                std::string reply = "425 Data connection failed\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                closeDataConn(dataconn);
-                continue;
-            }
-            std::string reply = "150 Here comes the directory listing\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
-
-            // Run 'ls -l path', send output
-            std::string listdir = resolvePath(root_dir_, arg.empty() ? "." : arg);
-            Logger::log(Logger::INFO, "listdir: "+listdir);
-
-            if (listdir.empty()) {
-                std::string reply = "550 Invalid directory\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                close(data_fd);
-                closeDataConn(dataconn);
-                continue;
-            }
-            std::string cmd = "ls -l " + listdir;
-            FILE* ls = popen(cmd.c_str(), "r");
-            if (ls) {
-                char lbuf[1024];
-                while (fgets(lbuf, sizeof(lbuf), ls)) {
-                    send(data_fd, lbuf, strlen(lbuf), 0);
-                }
-                pclose(ls);
+                offset += n;
+                n = 0;
             }
-            close(data_fd);
-            closeDataConn(dataconn);
-            dataconn.ready = false;
-            reply = "226 Directory send OK\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
-        } else if (cmd == "NOOP") {
-            std::string reply = "200 NOOP ok\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
-        } else if (cmd == "RETR") {
-            if (!dataconn.ready) {
-                std::string reply = "425 Use PASV first\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                continue;
-            }
-            int data_fd = acceptPassiveDataConn(dataconn);
-            if (data_fd == -1) {
-                std::string reply = "425 Data connection failed\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                closeDataConn(dataconn);
-                continue;
-            }
-            std::string filepath = resolvePath(root_dir_, arg);
-            if (filepath.empty()) {
-                std::string reply = "550 File not found\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                close(data_fd);
-                closeDataConn(dataconn);
-                continue;
-            }
-            FILE* f = fopen(filepath.c_str(), "rb");
-            if (!f) {
-                std::string reply = "550 File not found\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                close(data_fd);
-                closeDataConn(dataconn);
-                continue;
-            }
-            std::string reply = "150 Opening data connection for file transfer\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
+        }
+    }
+    replies.clear();
+    return ok;
+}
 
-            char filebuf[4096];
-            size_t n;
-            while ((n = fread(filebuf, 1, sizeof(filebuf), f)) > 0) {
-                if (send(data_fd, filebuf, n, 0) < 0) break;
-            }
-            fclose(f);
-            close(data_fd);
-            closeDataConn(dataconn);
-            dataconn.ready = false;
-            reply = "226 Transfer complete\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
-
-        } else if (cmd == "STOR") {
-            if (!dataconn.ready) {
-                std::string reply = "425 Use PASV first\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                continue;
-            }
-            int data_fd = acceptPassiveDataConn(dataconn);
-            if (data_fd == -1) {
-                std::string reply = "425 Data connection failed\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                closeDataConn(dataconn);
-                continue;
-            }
-            if (!isPathAllowed(root_dir_, arg)) {
-                std::string reply = "550 Invalid path\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                close(data_fd);
-                closeDataConn(dataconn);
-                continue;
-            }
-            std::string filepath = root_dir_ + "/" + arg;
-            FILE* f = fopen(filepath.c_str(), "wb");
-            if (!f) {
-                std::string reply = "550 Cannot open file for writing\r\n";
-                send(client_fd, reply.c_str(), reply.length(), 0);
-                close(data_fd);
-                closeDataConn(dataconn);
-                continue;
-            }
-            std::string reply = "150 Ok to send data\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
+// Handler table indexed by CommandId
+const FtpServer::CommandSpec& FtpServer::commandSpec(CommandId id) {
+    static const std::array<CommandSpec, (size_t)CommandId::Count> table = [] {
+        std::array<CommandSpec, (size_t)CommandId::Count> t{};
+        auto set = [&t](CommandId id, CommandHandler handler, bool needs_login, bool transfer) {
+            t[(size_t)id] = CommandSpec{handler, needs_login, transfer};
+        };
+        set(CommandId::USER, &FtpServer::cmdUser, false, false);
+        set(CommandId::PASS, &FtpServer::cmdPass, false, false);
+        set(CommandId::QUIT, &FtpServer::cmdQuit, false, false);
+        set(CommandId::NOOP, &FtpServer::cmdNoop, false, false);
+        set(CommandId::PASV, &FtpServer::cmdPasv, true, false);
+        set(CommandId::EPSV, &FtpServer::cmdEpsv, true, false);
+        set(CommandId::PORT, &FtpServer::cmdPort, true, false);
+        set(CommandId::EPRT, &FtpServer::cmdEprt, true, false);
+        set(CommandId::LIST, &FtpServer::cmdList, true, true);
+        set(CommandId::NLST, &FtpServer::cmdList, true, true);
+        set(CommandId::MLSD, &FtpServer::cmdList, true, true);
+        set(CommandId::RETR, &FtpServer::cmdRetr, true, true);
+        set(CommandId::STOR, &FtpServer::cmdStor, true, true);
+        set(CommandId::APPE, &FtpServer::cmdStor, true, true);
+        set(CommandId::REST, &FtpServer::cmdRest, true, false);
+        set(CommandId::RANG, &FtpServer::cmdRang, true, false);
+        set(CommandId::SIZE, &FtpServer::cmdSize, true, false);
+        set(CommandId::MDTM, &FtpServer::cmdSize, true, false);
+        set(CommandId::TYPE, &FtpServer::cmdType, true, false);
+        set(CommandId::MODE, &FtpServer::cmdMode, true, false);
+        set(CommandId::FEAT, &FtpServer::cmdFeat, false, false);
+        set(CommandId::ALLO, &FtpServer::cmdAllo, true, false);
+        set(CommandId::DELE, &FtpServer::cmdDele, true, false);
+        set(CommandId::RNFR, &FtpServer::cmdRnfr, true, false);
+        set(CommandId::RNTO, &FtpServer::cmdRnto, true, false);
+        set(CommandId::MKD, &FtpServer::cmdMkd, true, false);
+        set(CommandId::RMD, &FtpServer::cmdRmd, true, false);
+        set(CommandId::CWD, &FtpServer::cmdCwd, true, false);
+        set(CommandId::CDUP, &FtpServer::cmdCwd, true, false);
+        set(CommandId::PWD, &FtpServer::cmdPwd, true, false);
+        set(CommandId::HASH, &FtpServer::cmdHash, true, false);
+        set(CommandId::XCRC, &FtpServer::cmdHash, true, false);
+        set(CommandId::XMD5, &FtpServer::cmdHash, true, false);
+        set(CommandId::XSHA256, &FtpServer::cmdHash, true, false);
+        set(CommandId::OPTS, &FtpServer::cmdOpts, false, false);
+        set(CommandId::AUTH, &FtpServer::cmdAuth, false, false);
+        set(CommandId::PBSZ, &FtpServer::cmdPbsz, false, false);
+        set(CommandId::PROT, &FtpServer::cmdProt, false, false);
+        set(CommandId::SITE, &FtpServer::cmdSite, true, false);
+        return t;
+    }();
+    return table[(size_t)id];
+}
+
+bool FtpServer::processCommand(Session& session, const Command& command) {
+    const CommandSpec& spec = commandSpec(command.id);
+    if (!session.logged_in && (spec.needs_login || !spec.handler)) {
+        queueReply(session, "530 Please login with USER and PASS\r\n");
+        return true;
+    }
+    if (!spec.handler) {
+        queueReply(session, "502 Command not implemented\r\n");
+        return true;
+    }
+    auto start = Metrics::Clock::now();
+    bool keep = (this->*spec.handler)(session, command);
+    Metrics::observeCommand(command.id, start);
+    return keep;
+}
+
+// Waits for the client on the PASV socket. Returns the data fd, or -1 after
+// replying with the error.
+int FtpServer::openDataTransfer(Session& session) {
+    if (!session.dataconn.ready) {
+        queueReply(session, "425 Use PASV or PORT first\r\n");
+        return -1;
+    }
+    if (config_.tls_required && !session.prot_private) {
+        queueReply(session, "521 Data connections must be encrypted, use PROT P\r\n");
+        closeDataConn(session.dataconn);
+        return -1;
+    }
+    int data_fd = session.dataconn.active ? connectActiveDataConn(session.dataconn)
+                                          : acceptPassiveDataConn(session.dataconn);
+    if (data_fd == -1) {
+        queueReply(session, "425 Data connection failed\r\n");
+        closeDataConn(session.dataconn);
+        return -1;
+    }
+    return data_fd;
+}
+
+bool FtpServer::cmdUser(Session& session, const Command& command) {
+    if (config_.tls_required && !session.tls) {
+        queueReply(session, "530 Use AUTH TLS before logging in\r\n");
+        return true;
+    }
+    session.last_user = std::string(command.arg);
+    if (userauth_.allowsEmptyPassword(session.last_user)) {
+        return login(session);
+    }
+    queueReply(session, "331 Username ok, need password\r\n");
+    return true;
+}
+
+bool FtpServer::cmdPass(Session& session, const Command& command) {
+    if (session.last_user.empty()) {
+        queueReply(session, "503 Login with USER first\r\n");
+        return true;
+    }
+    switch (userauth_.checkPassword(session.last_user, std::string(command.arg))) {
+    case UserAuth::Result::Ok:
+        return login(session);
+    case UserAuth::Result::Busy:
+        queueReply(session, "421 Server busy, try again later\r\n");
+        return false;
+    case UserAuth::Result::Denied:
+        Metrics::add(Metrics::AuthFailures);
+        queueReply(session, "530 Login incorrect\r\n");
+        session.last_user.clear();
+        break;
+    }
+    return true;
+}
+
+// Logs last_user in after the password checked out. False ends the session.
+bool FtpServer::login(Session& session) {
+    if (session.counted_user != session.last_user) {
+        if (!admission_.admitUser(session.last_user)) {
+            queueReply(session, "421 Too many connections for this user\r\n");
+            return false;
+        }
+        if (!session.counted_user.empty()) admission_.releaseUser(session.counted_user);
+        session.counted_user = session.last_user;
+    }
+    session.logged_in = true;
+    uint64_t rate = userauth_.rateLimit(session.last_user);
+    if (rate > 0) {
+        std::lock_guard<std::mutex> lock(rate_mutex_);
+        auto& bucket = user_buckets_[session.last_user];
+        if (!bucket || bucket->rate() != rate) bucket = std::make_shared<TokenBucket>(rate, config_.rate_burst);
+        session.user_bucket = bucket;
+    }
+    queueReply(session, "230 User logged in, proceed\r\n");
+    return true;
+}
+
+bool FtpServer::cmdQuit(Session& session, const Command&) {
+    queueReply(session, "221 Goodbye\r\n");
+    return false;
+}
+
+bool FtpServer::cmdNoop(Session& session, const Command&) {
+    queueReply(session, "200 NOOP ok\r\n");
+    return true;
+}
+
+// RFC 2428 extended passive mode, the client reuses the control address
+bool FtpServer::cmdEpsv(Session& session, const Command& command) {
+    if (CommandParser::verbCode(command.arg) == CommandParser::verbCode("ALL")) {
+        session.epsv_all = true;
+        queueReply(session, "200 EPSV ALL ok\r\n");
+        return true;
+    }
+    if (openPassiveDataConn(session.dataconn, session.client_fd)) {
+        queueReply(session, "229 Entering Extended Passive Mode (|||" +
+            std::to_string(session.dataconn.port) + "|)\r\n");
+    } else {
+        queueReply(session, "425 Can't open data connection\r\n");
+    }
+    return true;
+}
+
+bool FtpServer::cmdPasv(Session& session, const Command&) {
+    if (session.epsv_all) {
+        queueReply(session, "503 PASV not allowed after EPSV ALL\r\n");
+        return true;
+    }
+    // PASV can only announce IPv4, IPv6 clients must use EPSV
+    std::string address = pasvAddress(session);
+    in_addr ip4;
+    if (inet_pton(AF_INET, address.c_str(), &ip4) != 1) {
+        queueReply(session, "425 PASV needs IPv4, use EPSV\r\n");
+        return true;
+    }
+    if (openPassiveDataConn(session.dataconn, session.client_fd)) {
+        // Send PASV reply (RFC 959 format: 227 Entering Passive Mode (h1,h2,h3,h4,p1,p2))
+        std::replace(address.begin(), address.end(), '.', ',');
+        int p1 = session.dataconn.port / 256;
+        int p2 = session.dataconn.port % 256;
+        queueReply(session, "227 Entering Passive Mode (" + address + "," +
+            std::to_string(p1) + "," + std::to_string(p2) + ")\r\n");
+    } else {
+        queueReply(session, "425 Can't open data connection\r\n");
+    }
+    return true;
+}
+
+// PORT h1,h2,h3,h4,p1,p2 (active mode)
+bool FtpServer::cmdPort(Session& session, const Command& command) {
+    int v[6];
+    std::string arg(command.arg);
+    if (std::sscanf(arg.c_str(), "%d,%d,%d,%d,%d,%d", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6) {
+        queueReply(session, "501 Syntax error in PORT\r\n");
+        return true;
+    }
+    std::string host = std::to_string(v[0]) + "." + std::to_string(v[1]) + "." +
+                       std::to_string(v[2]) + "." + std::to_string(v[3]);
+    return setActiveDataConn(session, host, v[4] * 256 + v[5]);
+}
+
+// EPRT |af|address|port| (RFC 2428), the first character is the delimiter
+bool FtpServer::cmdEprt(Session& session, const Command& command) {
+    std::string_view arg = command.arg;
+    std::string fields[4];
+    if (arg.size() < 2) {
+        queueReply(session, "501 Syntax error in EPRT\r\n");
+        return true;
+    }
+    char delim = arg[0];
+    size_t start = 1;
+    for (int i = 0; i < 3; ++i) {
+        size_t end = arg.find(delim, start);
+        if (end == std::string_view::npos) {
+            queueReply(session, "501 Syntax error in EPRT\r\n");
+            return true;
+        }
+        fields[i] = std::string(arg.substr(start, end - start));
+        start = end + 1;
+    }
+    if (fields[0] != "1" && fields[0] != "2") {
+        queueReply(session, "522 Network protocol not supported, use (1,2)\r\n");
+        return true;
+    }
+    return setActiveDataConn(session, fields[1], std::atoi(fields[2].c_str()));
+}
+
+bool FtpServer::setActiveDataConn(Session& session, const std::string& host, int port) {
+    sockaddr_storage addr;
+    socklen_t len;
+    if (port <= 0 || port > 65535 || !NetUtil::parseAddress(host, port, addr, len)) {
+        queueReply(session, "501 Invalid address\r\n");
+        return true;
+    }
+    // Only connect back to the client itself (no FTP bounce)
+    if (NetUtil::addressString(addr) != session.client_ip) {
+        queueReply(session, "504 Data address must match the control connection\r\n");
+        return true;
+    }
+    closeDataConn(session.dataconn);
+    session.dataconn.active = true;
+    session.dataconn.active_host = host;
+    session.dataconn.port = port;
+    session.dataconn.ready = true;
+    queueReply(session, "200 Active data connection set\r\n");
+    return true;
+}
+
+// Advertised address of the session's listener, or the address the client
+// reached us on
+std::string FtpServer::pasvAddress(const Session& session) {
+    const ListenSpec& spec = listeners_[session.listener];
+    if (!spec.advertise.empty()) return spec.advertise;
+    if (!config_.pasv_address.empty()) return config_.pasv_address;
+    sockaddr_storage local{};
+    socklen_t len = sizeof(local);
+    if (getsockname(session.client_fd, (sockaddr*)&local, &len) == -1) return "";
+    return NetUtil::addressString(local);
+}
+
+// LIST, NLST and MLSD
+bool FtpServer::cmdList(Session& session, const Command& command) {
+    int data_fd = openDataTransfer(session);
+    if (data_fd == -1) return true;
+
+    // Clients often send ls options ("LIST -la"), they are ignored
+    std::string_view target = command.arg;
+    while (!target.empty() && target[0] == '-') {
+        auto space = target.find(' ');
+        target = space == std::string_view::npos ? std::string_view() : target.substr(space + 1);
+    }
+    std::string path = target.empty() ? "." : std::string(target);
+    DirLister::Format format = command.id == CommandId::MLSD ? DirLister::MLSD
+                             : command.id == CommandId::NLST ? DirLister::NLST : DirLister::LIST;
+
+    std::string listdir;
+    int dir_fd = paths_.open(session.cwd, path, O_RDONLY | O_DIRECTORY, &listdir);
+    PathTarget entry;
+    // "LIST file" lists just that file
+    if (dir_fd == -1 && !(errno == ENOTDIR && format != DirLister::MLSD && paths_.locate(session.cwd, path, entry))) {
+        queueReply(session, "550 Invalid directory\r\n");
+        closeDataConn(session.dataconn);
+        return true;
+    }
+    queueReply(session, "150 Here comes the directory listing\r\n");
+    flushReplies(session);
+    DataChannel channel;
+    if (!openDataChannel(session, data_fd, channel)) {
+        if (dir_fd != -1) close(dir_fd);
+        return true;
+    }
+
+    // MODE Z compresses the same output, the listing cache keeps it plain
+    std::unique_ptr<Compression::Writer> deflater;
+    if (session.mode_z) deflater.reset(new Compression::Writer(channel));
+    DirLister::Sink sink = [&channel, &deflater](const char* data, size_t len) {
+        return deflater ? deflater->write(data, len) : channel.send(data, len);
+    };
+    bool ok;
+    if (dir_fd != -1) {
+        ok = sendListing(sink, dir_fd, listdir, format);
+        close(dir_fd);
+    } else {
+        ok = DirLister::listEntry(entry.dirfd, entry.name, format, sink);
+    }
+    if (ok && deflater) ok = deflater->finish();
+    closeDataConn(session.dataconn);
+    queueReply(session, ok ? "226 Directory send OK\r\n" : "451 Directory listing failed\r\n");
+    return true;
+}
+
+// Concurrent RETRs of one file share its fd through open_files_
+bool FtpServer::cmdRetr(Session& session, const Command& command) {
+    off_t offset = session.rest_offset;
+    off_t length = session.range_end >= 0 ? session.range_end - offset + 1 : -1;
+    session.rest_offset = 0;
+    session.range_end = -1;
+    int data_fd = openDataTransfer(session);
+    if (data_fd == -1) return true;
+
+    std::string filepath;
+    int fd = paths_.open(session.cwd, std::string(command.arg), O_RDONLY, &filepath);
+    OpenFileTable::Handle file = fd == -1 ? nullptr : open_files_.acquire(filepath, fd);
+    if (!file) {
+        queueReply(session, "550 File not found\r\n");
+        closeDataConn(session.dataconn);
+        return true;
+    }
+    queueReply(session, "150 Opening data connection for file transfer\r\n");
+    flushReplies(session);
+    DataChannel channel;
+    if (!openDataChannel(session, data_fd, channel)) return true;
+
+    // Only kernel sends may read the mapping: user-space TLS or deflate
+    // touching a page of a file truncated meanwhile would get SIGBUS
+    bool use_cache = file_cache_.enabled() && !session.mode_z && channel.rawSend();
+    FileCache::Handle mapping = use_cache ? file_cache_.lookup(filepath, file->fd) : nullptr;
+    Throttle throttle = makeThrottle(session);
+    channel.throttle = &throttle;
+    registerTransfer(session, throttle, command);
+    auto start = Metrics::Clock::now();
+    OpenFileTable::beginTransfer(*file, offset, length);
+    ssize_t sent;
+    if (session.mode_z) {
+        sent = sendCompressed(session, channel, file->fd, std::string(command.arg), offset, length);
+    } else if (mapping) {
+        sent = sendMapped(channel, *mapping, offset, length);
+        if (sent > 0) file_cache_.addServed(sent);
+    } else if (!channel.rawSend()) {
+        sent = Tls::sendFile(channel, file->fd, offset, length);
+    } else {
+        sent = config_.io_uring ? DataTransfer::sendFileUring(data_fd, file->fd, offset, length, &throttle)
+                                : DataTransfer::sendFile(data_fd, file->fd, offset, length, &throttle);
+    }
+    OpenFileTable::endTransfer(*file, sent);
+    unregisterTransfer(throttle);
+    Metrics::recordTransfer(true, sent, start);
+    file.reset();
+    closeDataConn(session.dataconn);
+    if (sent < 0) {
+        queueReply(session, "426 Connection closed; transfer aborted\r\n");
+    } else {
+        queueReply(session, "226 Transfer complete\r\n");
+    }
+    return true;
+}
+
+// STOR and APPE. A plain STOR writes a temp file that replaces the target on
+// success; APPE and STOR after REST write into the target in place.
+bool FtpServer::cmdStor(Session& session, const Command& command) {
+    off_t offset = session.rest_offset;
+    session.rest_offset = 0;
+    session.range_end = -1;
+    bool append = command.id == CommandId::APPE;
+    bool in_place = append || offset > 0;
 
-            char filebuf[4096];
-            ssize_t n;
-            while ((n = recv(data_fd, filebuf, sizeof(filebuf), 0)) > 0) {
-                fwrite(filebuf, 1, n, f);
+    int data_fd = openDataTransfer(session);
+    if (data_fd == -1) return true;
+
+    PathTarget target;
+    if (!paths_.locate(session.cwd, std::string(command.arg), target)) {
+        queueReply(session, "550 Invalid path\r\n");
+        closeDataConn(session.dataconn);
+        return true;
+    }
+    std::string temp_name;
+    int file_fd;
+    if (in_place) {
+        file_fd = paths_.openAt(target, O_WRONLY | O_CREAT);
+        struct stat st;
+        if (file_fd != -1 && fstat(file_fd, &st) == 0) {
+            if (append) {
+                offset = st.st_size;
+            } else if (offset > st.st_size) {
+                close(file_fd);
+                queueReply(session, "554 Restart offset beyond end of file\r\n");
+                closeDataConn(session.dataconn);
+                return true;
+            } else if (ftruncate(file_fd, offset) == -1) {
+                // Resumed upload replaces everything after the restart point
+                close(file_fd);
+                file_fd = -1;
             }
-            fclose(f);
-            close(data_fd);
-            closeDataConn(dataconn);
-            dataconn.ready = false;
-            reply = "226 Transfer complete\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
+        }
+    } else {
+        // Upload into a temp file next to the target, renamed over it on success
+        file_fd = openTempFile(target, temp_name);
+    }
+    if (file_fd == -1) {
+        queueReply(session, "550 Cannot open file for writing\r\n");
+        closeDataConn(session.dataconn);
+        return true;
+    }
+    if (session.alloc_hint > 0 &&
+        fallocate(file_fd, FALLOC_FL_KEEP_SIZE, offset, session.alloc_hint) == -1 && errno != EOPNOTSUPP) {
+        Logger::log(Logger::WARNING, std::string("fallocate failed: ") + strerror(errno));
+    }
+    session.alloc_hint = 0;
+    queueReply(session, "150 Ok to send data\r\n");
+    flushReplies(session);
+    DataChannel channel;
+    if (!openDataChannel(session, data_fd, channel)) {
+        close(file_fd);
+        if (!in_place) unlinkat(target.dirfd, temp_name.c_str(), 0);
+        return true;
+    }
 
-        } else {
-            std::string reply = "502 Command not implemented\r\n";
-            send(client_fd, reply.c_str(), reply.length(), 0);
+    // A complete upload is hashed on the way in and indexed under the
+    // session's HASH algorithm
+    std::unique_ptr<FileHash::Hasher> hasher;
+    if (config_.hash_uploads && hash_index_.enabled() && !in_place && !session.mode_z)
+        hasher.reset(new FileHash::Hasher(session.hash_algorithm));
+
+    DataTransfer::Tap tap;
+    if (hasher) tap = [&hasher](const char* data, size_t len) { hasher->update(data, len); };
+
+    Throttle throttle = makeThrottle(session);
+    channel.throttle = &throttle;
+    registerTransfer(session, throttle, command);
+    auto start = Metrics::Clock::now();
+    ssize_t received;
+    if (session.mode_z) {
+        received = Compression::receiveFile(channel, file_fd, offset);
+    } else if (!channel.rawReceive()) {
+        received = Tls::receiveFile(channel, file_fd, offset, tap);
+    } else if (hasher) {
+        received = DataTransfer::receiveFileBuffered(data_fd, file_fd, offset, config_.stor_buffer_size, &throttle,
+                                                     tap);
+    } else {
+        received = config_.io_uring ? DataTransfer::receiveFileUring(data_fd, file_fd, offset, &throttle)
+                                    : DataTransfer::receiveFile(data_fd, file_fd, offset, config_.stor_direct_io,
+                                                                config_.stor_buffer_size, &throttle);
+    }
+    unregisterTransfer(throttle);
+    std::string error = received < 0 ? strerror(errno) : "";
+    struct stat st;
+    if (hasher && (received < 0 || fstat(file_fd, &st) == -1)) hasher.reset();
+    if (close(file_fd) == -1 && received >= 0) {
+        received = -1;
+        error = strerror(errno);
+    }
+    closeDataConn(session.dataconn);
+    if (received >= 0 && !in_place && renameat(target.dirfd, temp_name.c_str(), target.dirfd, target.name.c_str()) == -1) {
+        received = -1;
+        error = strerror(errno);
+    }
+    Metrics::recordTransfer(false, received, start);
+    if (received < 0) {
+        // A failed in-place write keeps what arrived, so the client can resume it
+        if (!in_place) unlinkat(target.dirfd, temp_name.c_str(), 0);
+        Logger::log(Logger::ERROR, "STOR " + target.path() + " failed: " + error);
+        queueReply(session, "451 Transfer aborted: " + error + "\r\n");
+    } else {
+        if (hasher) hash_index_.store(st, session.hash_algorithm, 0, st.st_size - 1, hasher->hex());
+        queueReply(session, "226 Transfer complete\r\n");
+    }
+    invalidateCaches(target);
+    return true;
+}
+
+// Sends [offset, offset + length) of a cached mapping over a plain or kTLS
+// channel. A file truncated under the mapping makes the kernel's send()
+// fail with EFAULT, aborting the transfer.
+ssize_t FtpServer::sendMapped(DataChannel& channel, const FileCache::Mapping& mapping, off_t offset, off_t length) {
+    if ((size_t)offset >= mapping.size) return 0;
+    size_t len = mapping.size - offset;
+    if (length >= 0 && (size_t)length < len) len = length;
+    return channel.send(mapping.data + offset, len) ? (ssize_t)len : -1;
+}
+
+// PROT P: the data connection's TLS handshake, after the 150 as the client
+// expects. False (reply queued, data connection closed) on failure.
+bool FtpServer::openDataChannel(Session& session, int data_fd, DataChannel& channel) {
+    channel.fd = data_fd;
+    if (!session.prot_private) return true;
+    session.dataconn.tls = tls_.accept(data_fd, config_.data_timeout);
+    if (!session.dataconn.tls) {
+        queueReply(session, "425 TLS negotiation on the data connection failed\r\n");
+        closeDataConn(session.dataconn);
+        return false;
+    }
+    channel.tls = session.dataconn.tls;
+    channel.ktls_send = Tls::kernelSend(channel.tls);
+    return true;
+}
+
+// MODE Z RETR. A whole-file transfer with a fresh "name.gz" next to the
+// file sends the gzip's deflate data as is instead of compressing again.
+ssize_t FtpServer::sendCompressed(Session& session, DataChannel& channel, int file_fd, const std::string& path,
+                                  off_t offset, off_t length) {
+    if (offset == 0 && length < 0) {
+        int gz_fd = paths_.open(session.cwd, path + ".gz", O_RDONLY);
+        off_t gz_offset, gz_length;
+        if (gz_fd != -1 && Compression::gzipSibling(gz_fd, file_fd, gz_offset, gz_length)) {
+            ssize_t sent = Compression::sendGzipSibling(channel, gz_fd, gz_offset, gz_length, file_fd);
+            close(gz_fd);
+            return sent;
+        }
+        if (gz_fd != -1) close(gz_fd);
+    }
+    return Compression::sendFile(channel, file_fd, offset, length);
+}
+
+// REST <offset>: the next RETR/STOR starts at this byte
+bool FtpServer::cmdRest(Session& session, const Command& command) {
+    std::string arg(command.arg);
+    char* end = nullptr;
+    long long offset = std::strtoll(arg.c_str(), &end, 10);
+    if (arg.empty() || *end != '\0' || offset < 0) {
+        queueReply(session, "501 Invalid REST offset\r\n");
+        return true;
+    }
+    session.rest_offset = offset;
+    session.range_end = -1;
+    queueReply(session, "350 Restarting at " + std::to_string(offset) + "\r\n");
+    return true;
+}
+
+// RANG <start> <end> (draft-bryan-ftpext-rang): the next RETR sends only the
+// inclusive byte range. Clients download one file in segments over parallel
+// data connections this way. "RANG 1 0" resets the range.
+bool FtpServer::cmdRang(Session& session, const Command& command) {
+    std::string arg(command.arg);
+    char* end = nullptr;
+    long long first = std::strtoll(arg.c_str(), &end, 10);
+    bool valid = !arg.empty() && *end == ' ';
+    long long last = valid ? std::strtoll(end + 1, &end, 10) : 0;
+    valid = valid && *end == '\0' && first >= 0 && last >= 0;
+    if (valid && first == 1 && last == 0) {
+        session.rest_offset = 0;
+        session.range_end = -1;
+        queueReply(session, "350 Restarting at 0. Byte range reset\r\n");
+        return true;
+    }
+    if (!valid || last < first) {
+        queueReply(session, "501 Invalid byte range\r\n");
+        return true;
+    }
+    session.rest_offset = first;
+    session.range_end = last;
+    queueReply(session, "350 Restarting at " + std::to_string(first) + ". End byte range at " +
+                            std::to_string(last) + "\r\n");
+    return true;
+}
+
+// SIZE and MDTM (RFC 3659), both answered from one stat
+bool FtpServer::cmdSize(Session& session, const Command& command) {
+    int fd = paths_.open(session.cwd, std::string(command.arg), O_PATH);
+    struct stat st;
+    bool found = fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (fd != -1) close(fd);
+    if (!found) {
+        queueReply(session, "550 Could not get file size\r\n");
+        return true;
+    }
+    if (command.id == CommandId::SIZE) {
+        queueReply(session, "213 " + std::to_string(st.st_size) + "\r\n");
+    } else {
+        struct tm tm;
+        gmtime_r(&st.st_mtime, &tm);
+        char buf[32];
+        strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", &tm);
+        queueReply(session, std::string("213 ") + buf + "\r\n");
+    }
+    return true;
+}
+
+// Transfers are always binary, TYPE is accepted for client compatibility
+bool FtpServer::cmdType(Session& session, const Command& command) {
+    char type = command.arg.empty() ? ' ' : command.arg[0] & ~0x20;
+    if (type != 'A' && type != 'I' && type != 'L') {
+        queueReply(session, "504 Type not supported\r\n");
+        return true;
+    }
+    queueReply(session, "200 Type set\r\n");
+    return true;
+}
+
+// MODE S (stream) and MODE Z (deflate, draft-preston-ftpext-deflate)
+bool FtpServer::cmdMode(Session& session, const Command& command) {
+    char mode = command.arg.size() == 1 ? command.arg[0] & ~0x20 : ' ';
+    if (mode != 'S' && mode != 'Z') {
+        queueReply(session, "504 Mode not supported\r\n");
+        return true;
+    }
+    session.mode_z = mode == 'Z';
+    queueReply(session, mode == 'Z' ? "200 Mode set to Z\r\n" : "200 Mode set to S\r\n");
+    return true;
+}
+
+bool FtpServer::cmdFeat(Session& session, const Command&) {
+    // HASH lists every algorithm, the selected one marked with '*'
+    std::string hash = " HASH ";
+    for (int i = 0; i < FileHash::ALGORITHM_COUNT; ++i) {
+        auto algorithm = static_cast<FileHash::Algorithm>(i);
+        if (i > 0) hash += ';';
+        hash += FileHash::name(algorithm);
+        if (algorithm == session.hash_algorithm) hash += '*';
+    }
+    std::string tls = tls_.enabled() ? " AUTH TLS\r\n PBSZ\r\n PROT\r\n" : "";
+    queueReply(session, "211-Features:\r\n" + tls +
+                        " EPRT\r\n"
+                        " EPSV\r\n" +
+                        hash + "\r\n"
+                        " MDTM\r\n"
+                        " MLSD\r\n"
+                        " MODE Z\r\n"
+                        " RANG STREAM\r\n"
+                        " REST STREAM\r\n"
+                        " SIZE\r\n"
+                        "211 End\r\n");
+    return true;
+}
+
+// AUTH TLS (RFC 4217; "AUTH SSL" is taken as the same). The 234 goes out in
+// the clear, then the control connection becomes a TLS server connection.
+bool FtpServer::cmdAuth(Session& session, const Command& command) {
+    auto code = CommandParser::verbCode(command.arg);
+    if (code != CommandParser::verbCode("TLS") && code != CommandParser::verbCode("SSL")) {
+        queueReply(session, "504 Unsupported security mechanism\r\n");
+        return true;
+    }
+    if (!tls_.enabled()) {
+        queueReply(session, "431 TLS is not configured\r\n");
+        return true;
+    }
+    if (session.tls) {
+        queueReply(session, "503 Already using TLS\r\n");
+        return true;
+    }
+    queueReply(session, "234 Proceed with negotiation\r\n");
+    if (!flushReplies(session)) return false;
+    session.tls = tls_.accept(session.client_fd, config_.data_timeout);
+    // A failed handshake leaves the connection in an unknown state
+    return session.tls != nullptr;
+}
+
+// PBSZ: TLS has no buffer size to agree on, it is always 0
+bool FtpServer::cmdPbsz(Session& session, const Command&) {
+    if (!session.tls) {
+        queueReply(session, "503 PBSZ needs a TLS control connection\r\n");
+        return true;
+    }
+    session.pbsz = true;
+    queueReply(session, "200 PBSZ=0\r\n");
+    return true;
+}
+
+// PROT P encrypts the following data connections, PROT C turns it off
+bool FtpServer::cmdProt(Session& session, const Command& command) {
+    if (!session.tls || !session.pbsz) {
+        queueReply(session, "503 PROT needs AUTH TLS and PBSZ first\r\n");
+        return true;
+    }
+    char level = command.arg.size() == 1 ? command.arg[0] & ~0x20 : ' ';
+    if (level == 'S' || level == 'E') {
+        queueReply(session, "536 Only PROT C and P are supported\r\n");
+        return true;
+    }
+    if (level != 'C' && level != 'P') {
+        queueReply(session, "504 Unknown protection level\r\n");
+        return true;
+    }
+    if (level == 'C' && config_.tls_required) {
+        queueReply(session, "534 Data connections must be encrypted\r\n");
+        return true;
+    }
+    session.prot_private = level == 'P';
+    queueReply(session, level == 'P' ? "200 PROT now Private\r\n" : "200 PROT now Clear\r\n");
+    return true;
+}
+
+// OPTS HASH [algorithm] shows or selects the algorithm HASH uses
+bool FtpServer::cmdOpts(Session& session, const Command& command) {
+    Command option = CommandParser::parse(command.arg);
+    if (CommandParser::verbCode(option.verb) != CommandParser::verbCode("HASH")) {
+        queueReply(session, "501 Option not understood\r\n");
+        return true;
+    }
+    if (!option.arg.empty() && !FileHash::parse(option.arg, session.hash_algorithm)) {
+        queueReply(session, "501 Unknown algorithm\r\n");
+        return true;
+    }
+    queueReply(session, std::string("200 ") + FileHash::name(session.hash_algorithm) + "\r\n");
+    return true;
+}
+
+// Splits XCRC/XMD5/XSHA256 arguments, "path [start [end]]" with end
+// exclusive. The path may be quoted.
+static bool parseHashArgs(std::string_view arg, std::string& path, off_t& first, off_t& last) {
+    std::vector<long long> numbers;
+    while (numbers.size() < 2) {
+        size_t space = arg.rfind(' ');
+        if (space == std::string_view::npos || space + 1 == arg.size()) break;
+        std::string_view token = arg.substr(space + 1);
+        if (token.find_first_not_of("0123456789") != std::string_view::npos) break;
+        numbers.insert(numbers.begin(), std::strtoll(std::string(token).c_str(), nullptr, 10));
+        arg = arg.substr(0, space);
+    }
+    if (arg.size() >= 2 && arg.front() == '"' && arg.back() == '"') arg = arg.substr(1, arg.size() - 2);
+    path = std::string(arg);
+    first = numbers.empty() ? 0 : numbers[0];
+    last = numbers.size() < 2 ? -1 : numbers[1] - 1;
+    return !path.empty() && (numbers.size() < 2 || numbers[1] > numbers[0]);
+}
+
+// HASH (draft-bryan-ftpext-hash) digests the RANG range of a file, or all of
+// it, with the OPTS HASH algorithm. XCRC, XMD5 and XSHA256 take the range as
+// arguments and reply with just the digest. Results go into hash_index_.
+bool FtpServer::cmdHash(Session& session, const Command& command) {
+    std::string path;
+    off_t first = 0, last = -1; // -1 = to EOF
+    FileHash::Algorithm algorithm = session.hash_algorithm;
+    if (command.id == CommandId::HASH) {
+        path = std::string(command.arg);
+        if (session.range_end >= 0) {
+            first = session.rest_offset;
+            last = session.range_end;
+            session.rest_offset = 0;
+            session.range_end = -1;
         }
+    } else {
+        algorithm = command.id == CommandId::XCRC ? FileHash::CRC32
+                  : command.id == CommandId::XMD5 ? FileHash::MD5 : FileHash::SHA256;
+        if (!parseHashArgs(command.arg, path, first, last)) {
+            queueReply(session, "501 Invalid arguments\r\n");
+            return true;
+        }
+    }
+
+    int fd = path.empty() ? -1 : paths_.open(session.cwd, path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) close(fd);
+        queueReply(session, "550 File not found\r\n");
+        return true;
+    }
+    if (last < 0 || last >= st.st_size) last = st.st_size - 1;
+    if (first > st.st_size) {
+        close(fd);
+        queueReply(session, "501 Invalid byte range\r\n");
+        return true;
+    }
+
+    std::string hex;
+    bool ok = hash_index_.enabled() && hash_index_.lookup(st, algorithm, first, last, hex);
+    if (!ok) {
+        ok = FileHash::hashFile(fd, algorithm, first, last - first + 1, hex);
+        if (ok && hash_index_.enabled()) hash_index_.store(st, algorithm, first, last, hex);
+    }
+    close(fd);
+    if (!ok) {
+        queueReply(session, "451 Could not read file\r\n");
+    } else if (command.id == CommandId::HASH) {
+        queueReply(session, std::string("213 ") + FileHash::name(algorithm) + " " + std::to_string(first) + "-" +
+                                std::to_string(std::max(first, last)) + " " + hex + " " + path + "\r\n");
+    } else {
+        queueReply(session, "250 " + hex + "\r\n");
+    }
+    return true;
+}
+
+// Size hint for the next STOR, used to preallocate the file
+bool FtpServer::cmdAllo(Session& session, const Command& command) {
+    session.alloc_hint = std::strtoll(std::string(command.arg).c_str(), nullptr, 10);
+    queueReply(session, "200 ALLO command successful\r\n");
+    return true;
+}
+
+bool FtpServer::cmdDele(Session& session, const Command& command) {
+    PathTarget target;
+    if (!paths_.locate(session.cwd, std::string(command.arg), target) ||
+        unlinkat(target.dirfd, target.name.c_str(), 0) == -1) {
+        queueReply(session, "550 Delete operation failed\r\n");
+        return true;
+    }
+    invalidateCaches(target);
+    queueReply(session, "250 Delete operation successful\r\n");
+    return true;
+}
+
+bool FtpServer::cmdRnfr(Session& session, const Command& command) {
+    struct stat st;
+    if (!paths_.locate(session.cwd, std::string(command.arg), session.rename_from, true) ||
+        fstatat(session.rename_from.dirfd, session.rename_from.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        session.rename_from.reset();
+        queueReply(session, "550 File not found\r\n");
+        return true;
+    }
+    queueReply(session, "350 Ready for RNTO\r\n");
+    return true;
+}
+
+bool FtpServer::cmdRnto(Session& session, const Command& command) {
+    if (!session.rename_from.valid()) {
+        queueReply(session, "503 RNFR required first\r\n");
+        return true;
+    }
+    PathTarget from = std::move(session.rename_from);
+    PathTarget to;
+    struct stat st;
+    bool is_dir = fstatat(from.dirfd, from.name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+    if (!paths_.locate(session.cwd, std::string(command.arg), to) ||
+        renameat(from.dirfd, from.name.c_str(), to.dirfd, to.name.c_str()) == -1) {
+        queueReply(session, "550 Rename failed\r\n");
+        return true;
+    }
+    if (is_dir) paths_.invalidateDirs();
+    invalidateCaches(from);
+    invalidateCaches(to);
+    queueReply(session, "250 Rename successful\r\n");
+    return true;
+}
+
+bool FtpServer::cmdMkd(Session& session, const Command& command) {
+    PathTarget target;
+    if (!paths_.locate(session.cwd, std::string(command.arg), target) ||
+        mkdirat(target.dirfd, target.name.c_str(), 0755) == -1) {
+        queueReply(session, "550 Create directory operation failed\r\n");
+        return true;
+    }
+    invalidateCaches(target);
+    queueReply(session, "257 " + quotePath(paths_.clientPath(target.path())) + " created\r\n");
+    return true;
+}
+
+bool FtpServer::cmdRmd(Session& session, const Command& command) {
+    PathTarget target;
+    if (!paths_.locate(session.cwd, std::string(command.arg), target) ||
+        unlinkat(target.dirfd, target.name.c_str(), AT_REMOVEDIR) == -1) {
+        queueReply(session, "550 Remove directory operation failed\r\n");
+        return true;
+    }
+    paths_.invalidateDirs();
+    invalidateCaches(target);
+    queueReply(session, "250 Remove directory operation successful\r\n");
+    return true;
+}
+
+// CWD and CDUP
+bool FtpServer::cmdCwd(Session& session, const Command& command) {
+    std::string path = command.id == CommandId::CDUP ? ".." : std::string(command.arg);
+    if (path.empty() || !paths_.changeDir(session.cwd, path)) {
+        queueReply(session, "550 Failed to change directory\r\n");
+        return true;
+    }
+    queueReply(session, "250 Directory successfully changed\r\n");
+    return true;
+}
+
+bool FtpServer::cmdPwd(Session& session, const Command&) {
+    queueReply(session, "257 " + quotePath(session.cwd.path()) + " is the current directory\r\n");
+    return true;
+}
+
+// RFC 959 quoting for 257 replies: embedded quotes are doubled
+std::string FtpServer::quotePath(const std::string& path) {
+    std::string quoted = "\"";
+    for (char c : path) {
+        if (c == '"') quoted += '"';
+        quoted += c;
     }
+    return quoted + "\"";
+}
+
+bool FtpServer::cmdSite(Session& session, const Command& command) {
+    Command sub = CommandParser::parse(command.arg);
+    if (CommandParser::verbCode(sub.verb) != CommandParser::verbCode("STATS")) {
+        queueReply(session, "504 SITE command not implemented for that parameter\r\n");
+        return true;
+    }
+    queueReply(session, "211-Server statistics\r\n" + statsReport(&session) + "211 End\r\n");
+    return true;
+}
+
+void FtpServer::endSession(Session& session) {
+    Tls::shutdown(session.tls);
+    session.tls = nullptr;
     // Close client socket
-    close(client_fd);
-    closeDataConn(dataconn);
+    close(session.client_fd);
+    session.client_fd = -1;
+    closeDataConn(session.dataconn);
+    if (!session.counted_user.empty()) admission_.releaseUser(session.counted_user);
+    if (session.admitted) admission_.releaseClient(session.client_ip);
+    session.counted_user.clear();
+    session.admitted = false;
     Logger::log(Logger::INFO, "Client disconnected.");
 }
 
-bool FtpServer::openPassiveDataConn(DataConn& dataconn, int /*control_fd*/) {
-    dataconn.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (dataconn.listen_fd == -1) return false;
+bool FtpServer::openPassiveDataConn(DataConn& dataconn, int control_fd) {
+    auto start = Metrics::Clock::now();
+    // A second PASV replaces the previous data socket
+    closeDataConn(dataconn);
 
-    sockaddr_in data_addr{};
-    data_addr.sin_family = AF_INET;
-    data_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    // Listen on the address the client reached the control connection on
+    sockaddr_storage data_addr{};
+    socklen_t addrlen = sizeof(data_addr);
+    if (getsockname(control_fd, (sockaddr*)&data_addr, &addrlen) == -1) return false;
 
-    // Try random port between 20000-21000
-    for (int p = 20000; p <= 21000; ++p) {
-        data_addr.sin_port = htons(p);
-        if (bind(dataconn.listen_fd, (sockaddr*)&data_addr, sizeof(data_addr)) == 0) {
+    dataconn.listen_fd = socket(data_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (dataconn.listen_fd == -1) return false;
+    int one = 1;
+    setsockopt(dataconn.listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // Ports come from the allocator; bind only fails if another process
+    // holds the port, then a few more are tried before giving up
+    for (int attempt = 0; attempt < 8 && dataconn.port == 0; ++attempt) {
+        int p = pasv_ports_.acquire();
+        if (p == 0) break;
+        NetUtil::setPort(data_addr, p);
+        if (bind(dataconn.listen_fd, (sockaddr*)&data_addr, addrlen) == 0) {
             dataconn.port = p;
-            break;
+        } else {
+            pasv_ports_.release(p);
         }
     }
     if (dataconn.port == 0) {
+        Logger::log(Logger::WARNING, "No passive port available");
         close(dataconn.listen_fd);
         dataconn.listen_fd = -1;
         return false;
     }
     if (listen(dataconn.listen_fd, 1) != 0) {
-        close(dataconn.listen_fd);
-        dataconn.listen_fd = -1;
-        dataconn.port = 0;
+        closeDataConn(dataconn);
         return false;
     }
     dataconn.ready = true;
+    Metrics::observeSince(Metrics::PasvSetup, start);
     return true;
 }
 
+int FtpServer::connectActiveDataConn(DataConn& dataconn) {
+    sockaddr_storage addr;
+    socklen_t len;
+    if (!NetUtil::parseAddress(dataconn.active_host, dataconn.port, addr, len)) return -1;
+    dataconn.conn_fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (dataconn.conn_fd == -1) return -1;
+
+    // Non-blocking connect so an unreachable client costs at most data_timeout
+    bool ok = connect(dataconn.conn_fd, (sockaddr*)&addr, len) == 0;
+    if (!ok && errno == EINPROGRESS) {
+        pollfd pfd{dataconn.conn_fd, POLLOUT, 0};
+        int timeout_ms = config_.data_timeout > 0 ? config_.data_timeout * 1000 : -1;
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        ok = poll(&pfd, 1, timeout_ms) == 1 &&
+             getsockopt(dataconn.conn_fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0;
+    }
+    if (!ok) {
+        close(dataconn.conn_fd);
+        dataconn.conn_fd = -1;
+        return -1;
+    }
+    fcntl(dataconn.conn_fd, F_SETFL, fcntl(dataconn.conn_fd, F_GETFL) & ~O_NONBLOCK);
+    setDataTimeouts(dataconn.conn_fd);
+    return dataconn.conn_fd;
+}
+
 int FtpServer::acceptPassiveDataConn(DataConn& dataconn) {
-    sockaddr_in cli_addr{};
-    socklen_t clen = sizeof(cli_addr);
-    dataconn.conn_fd = accept(dataconn.listen_fd, (sockaddr*)&cli_addr, &clen);
+    pollfd pfd{dataconn.listen_fd, POLLIN, 0};
+    int timeout_ms = config_.data_timeout > 0 ? config_.data_timeout * 1000 : -1;
+    int ready;
+    while ((ready = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR) {}
+    if (ready == 1) {
+        sockaddr_storage cli_addr{};
+        socklen_t clen = sizeof(cli_addr);
+        dataconn.conn_fd = accept4(dataconn.listen_fd, (sockaddr*)&cli_addr, &clen, SOCK_CLOEXEC);
+    } else if (ready == 0) {
+        Logger::log(Logger::WARNING, "Timed out waiting for the passive data connection");
+    }
     close(dataconn.listen_fd);
     dataconn.listen_fd = -1;
+    if (dataconn.conn_fd != -1) setDataTimeouts(dataconn.conn_fd);
     return dataconn.conn_fd;
 }
 
+// Transfers that make no progress for data_timeout fail with EAGAIN
+void FtpServer::setDataTimeouts(int fd) {
+    if (config_.data_timeout <= 0) return;
+    timeval tv{config_.data_timeout, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
 void FtpServer::closeDataConn(DataConn& dataconn) {
+    Tls::shutdown(dataconn.tls);
+    dataconn.tls = nullptr;
     if (dataconn.conn_fd != -1) close(dataconn.conn_fd);
     if (dataconn.listen_fd != -1) close(dataconn.listen_fd);
+    if (dataconn.port != 0 && !dataconn.active) pasv_ports_.release(dataconn.port);
+    dataconn.active = false;
+    dataconn.active_host.clear();
     dataconn.conn_fd = -1;
     dataconn.listen_fd = -1;
     dataconn.ready = false;
     dataconn.port = 0;
 }
 
-// Returns the real absolute path, or "" on error
-std::string FtpServer::resolvePath(const std::string& root, const std::string& user_path) {
-    std::string candidate = root + "/" + user_path;
-
-    char absbuf[PATH_MAX];
-    if (realpath(candidate.c_str(), absbuf) == nullptr) return "";
-
-    std::string abs(absbuf);
-    // Ensure abs starts with root's real path
-    char rootbuf[PATH_MAX];
-    if (realpath(root.c_str(), rootbuf) == nullptr) return "";
-    
-    std::string absroot(rootbuf);
-    if (abs.compare(0, absroot.size(), absroot) != 0) return ""; // Outside jail!
-    
-    return abs;
-}
-
-bool FtpServer::isPathAllowed(const std::string& root, const std::string& user_path) {
-    // Find parent directory
-    std::string candidate = root + "/" + user_path;
-    char* cand_dup = strdup(candidate.c_str()); // dirname may modify the input
-    std::string parent_dir = dirname(cand_dup);
-    free(cand_dup);
-
-    char parent_abs[PATH_MAX];
-    if (realpath(parent_dir.c_str(), parent_abs) == nullptr)
-        return false; // Parent does not exist
-    char root_abs[PATH_MAX];
-    if (realpath(root.c_str(), root_abs) == nullptr)
-        return false;
-    // Must be inside jail
-    std::string abs_parent(parent_abs);
-    std::string abs_root(root_abs);
-    return abs_parent.compare(0, abs_root.size(), abs_root) == 0;
-}
\ No newline at end of file
+// Sends a directory listing, served from and filled into the listing cache
+bool FtpServer::sendListing(const DirLister::Sink& send_fn, int dir_fd, const std::string& listdir,
+                            DirLister::Format format) {
+    if (!listing_cache_.enabled()) return DirLister::list(dir_fd, format, send_fn);
+
+    std::string cached;
+    if (listing_cache_.lookup(listdir, format, cached))
+        return send_fn(cached.data(), cached.size());
+
+    uint64_t token = listing_cache_.prepare(listdir);
+    std::string rendered;
+    bool cacheable = true;
+    bool ok = DirLister::list(dir_fd, format, [&](const char* data, size_t len) {
+        if (cacheable && rendered.size() + len <= listing_cache_.maxEntrySize()) {
+            rendered.append(data, len);
+        } else {
+            cacheable = false;
+            rendered.clear();
+        }
+        return send_fn(data, len);
+    });
+    if (ok && cacheable) listing_cache_.store(listdir, format, token, std::move(rendered));
+    return ok;
+}
+
+// Drops cached listings of target's directory and of target itself, and the
+// cached file. inotify catches listing changes too, but only asynchronously.
+void FtpServer::invalidateCaches(const PathTarget& target) {
+    std::string path = target.path();
+    if (listing_cache_.enabled()) {
+        listing_cache_.invalidate(target.dir);
+        listing_cache_.invalidate(path);
+    }
+    if (file_cache_.enabled()) file_cache_.invalidate(path);
+}
+
+// Limits that apply to a transfer of this session, tightest wins
+Throttle FtpServer::makeThrottle(const Session& session) {
+    std::vector<std::shared_ptr<TokenBucket>> buckets;
+    if (session.session_bucket) buckets.push_back(session.session_bucket);
+    if (session.user_bucket) buckets.push_back(session.user_bucket);
+    if (global_bucket_) buckets.push_back(global_bucket_);
+    return Throttle(std::move(buckets));
+}
+
+void FtpServer::registerTransfer(const Session& session, const Throttle& throttle, const Command& command) {
+    std::string desc = session.client_ip + ":" + std::to_string(session.client_port) + " " + session.last_user +
+                       " " + std::string(command.verb) + " " + std::string(command.arg);
+    std::lock_guard<std::mutex> lock(rate_mutex_);
+    transfers_[&throttle] = TransferInfo{&session, std::move(desc)};
+}
+
+void FtpServer::unregisterTransfer(const Throttle& throttle) {
+    std::lock_guard<std::mutex> lock(rate_mutex_);
+    transfers_.erase(&throttle);
+}
+
+// Metrics plus the gauges that live in the server's own structures
+std::string FtpServer::metricsReport() {
+    std::ostringstream out;
+    out << Metrics::render();
+    AdmissionControl::Stats adm = admission_.stats();
+    out << "# HELP ftp_sessions Open control connections\n"
+        << "# TYPE ftp_sessions gauge\n"
+        << "ftp_sessions " << adm.sessions << "\n"
+        << "# HELP ftp_pasv_ports_in_use Passive ports handed out\n"
+        << "# TYPE ftp_pasv_ports_in_use gauge\n"
+        << "ftp_pasv_ports_in_use " << pasv_ports_.inUse() << "\n"
+        << "# HELP ftp_log_dropped_total Log messages dropped by full ring buffers\n"
+        << "# TYPE ftp_log_dropped_total counter\n"
+        << "ftp_log_dropped_total " << Logger::droppedCount() << "\n";
+    {
+        std::lock_guard<std::mutex> lock(rate_mutex_);
+        out << "# HELP ftp_transfers_active Transfers in progress\n"
+            << "# TYPE ftp_transfers_active gauge\n"
+            << "ftp_transfers_active " << transfers_.size() << "\n";
+    }
+    if (file_cache_.enabled()) {
+        FileCache::Stats st = file_cache_.stats();
+        out << "# TYPE ftp_file_cache_hits_total counter\n"
+            << "ftp_file_cache_hits_total " << st.hits << "\n"
+            << "# TYPE ftp_file_cache_misses_total counter\n"
+            << "ftp_file_cache_misses_total " << st.misses << "\n"
+            << "# TYPE ftp_file_cache_bytes gauge\n"
+            << "ftp_file_cache_bytes " << st.bytes << "\n";
+    }
+    if (listing_cache_.enabled()) {
+        ListingCache::Stats st = listing_cache_.stats();
+        out << "# TYPE ftp_listing_cache_hits_total counter\n"
+            << "ftp_listing_cache_hits_total " << st.hits << "\n"
+            << "# TYPE ftp_listing_cache_misses_total counter\n"
+            << "ftp_listing_cache_misses_total " << st.misses << "\n";
+    }
+    return out.str();
+}
+
+// Minimal HTTP/1.0 responder: every request gets the metrics and the
+// connection is closed. Scrapes are rare, so one thread serves them in turn.
+void FtpServer::serveMetrics(int listen_fd) {
+    std::time_t last_error = 0;
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EMFILE || errno == ENFILE) {
+                shedConnection(listen_fd);
+            } else if (errno != EINTR && errno != ECONNABORTED && std::time(nullptr) != last_error) {
+                last_error = std::time(nullptr);
+                Logger::log(Logger::ERROR, std::string("Metrics accept failed: ") + strerror(errno));
+            }
+            continue;
+        }
+        timeval tv{2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        // Read up to the end of the request headers
+        std::string request;
+        char buf[1024];
+        ssize_t n;
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192 &&
+               (n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            request.append(buf, n);
+        }
+        // "/stats" is the full SITE STATS report, anything else the metrics
+        bool stats = request.compare(request.find(' ') + 1, 7, "/stats ") == 0;
+        std::string body = stats ? statsReport() : metricsReport();
+        std::string response = std::string("HTTP/1.0 200 OK\r\n") +
+                               (stats ? "Content-Type: text/plain\r\n" : "Content-Type: text/plain; version=0.0.4\r\n") +
+                               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                               "Connection: close\r\n\r\n";
+        if (request.compare(0, 4, "HEAD") != 0) response += body;
+        DataTransfer::sendBuffer(fd, response.data(), response.size());
+        close(fd);
+    }
+}
+
+static sigset_t serverSignals() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGHUP);
+    return signals;
+}
+
+void FtpServer::blockSignals() {
+    sigset_t signals = serverSignals();
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+}
+
+void FtpServer::startSignalThread() {
+    blockSignals();
+    sigset_t signals = serverSignals();
+    std::thread([this, signals]() {
+        while (true) {
+            int sig;
+            if (sigwait(&signals, &sig) != 0) continue;
+            if (sig == SIGUSR1) Logger::log(Logger::INFO, "Metrics:\n" + metricsReport() + "Stats:\n" + statsReport());
+            else if (sig == SIGHUP) reloadUsers();
+        }
+    }).detach();
+}
+
+void FtpServer::reloadUsers() {
+    if (userauth_.reload())
+        Logger::log(Logger::INFO, "Reloaded user file " + userauth_.filename());
+    else
+        Logger::log(Logger::ERROR, "Failed to reload user file " + userauth_.filename() + ", keeping the old one");
+}
+
+// Watches the directory rather than the file: editors and deploy scripts
+// usually write a new file and rename it over the old one
+void FtpServer::watchUsersFile() {
+    const std::string& path = userauth_.filename();
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        Logger::log(Logger::WARNING, "Cannot watch " + path + ", reload it with SIGHUP");
+        if (fd != -1) close(fd);
+        return;
+    }
+    alignas(inotify_event) char buf[4096];
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            break;
+        }
+        bool changed = false;
+        for (char* p = buf; p < buf + n;) {
+            auto* event = reinterpret_cast<inotify_event*>(p);
+            if (event->len > 0 && name == event->name) changed = true;
+            p += sizeof(inotify_event) + event->len;
+        }
+        if (changed) reloadUsers();
+    }
+    close(fd);
+}
+
+std::string FtpServer::statsReport(const Session* viewer) {
+    if (viewer && std::find(config_.stats_admins.begin(), config_.stats_admins.end(), viewer->counted_user) !=
+                      config_.stats_admins.end())
+        viewer = nullptr;
+    std::ostringstream out;
+    out << " log_dropped " << Logger::droppedCount() << "\r\n";
+    AdmissionControl::Stats adm = admission_.stats();
+    out << " sessions " << adm.sessions << "\r\n"
+        << " sessions_rejected " << adm.rejected_total << "\r\n"
+        << " sessions_rejected_ip " << adm.rejected_ip << "\r\n"
+        << " sessions_rejected_user " << adm.rejected_user << "\r\n";
+    out << " pasv_ports_in_use " << pasv_ports_.inUse() << "\r\n"
+        << " pasv_ports_total " << pasv_ports_.capacity() << "\r\n";
+    if (listing_cache_.enabled()) {
+        ListingCache::Stats st = listing_cache_.stats();
+        out << " listing_cache_hits " << st.hits << "\r\n"
+            << " listing_cache_misses " << st.misses << "\r\n"
+            << " listing_cache_evictions " << st.evictions << "\r\n"
+            << " listing_cache_invalidations " << st.invalidations << "\r\n"
+            << " listing_cache_entries " << st.entries << "\r\n"
+            << " listing_cache_bytes " << st.bytes << "\r\n";
+    }
+    if (tls_.enabled()) {
+        Tls::Stats st = tls_.stats();
+        out << " tls_handshakes " << st.handshakes << "\r\n"
+            << " tls_resumed " << st.resumed << "\r\n"
+            << " tls_failed " << st.failed << "\r\n"
+            << " tls_ktls_send " << st.ktls_send << "\r\n";
+    }
+    if (hash_index_.enabled()) {
+        HashIndex::Stats st = hash_index_.stats();
+        out << " hash_index_hits " << st.hits << "\r\n"
+            << " hash_index_misses " << st.misses << "\r\n"
+            << " hash_index_entries " << st.entries << "\r\n";
+    }
+    if (file_cache_.enabled()) {
+        FileCache::Stats st = file_cache_.stats();
+        uint64_t lookups = st.hits + st.misses;
+        out << " file_cache_hits " << st.hits << "\r\n"
+            << " file_cache_misses " << st.misses << "\r\n"
+            << " file_cache_hit_ratio " << (lookups ? (double)st.hits / lookups : 0.0) << "\r\n"
+            << " file_cache_bytes_served " << st.bytes_served << "\r\n"
+            << " file_cache_evictions " << st.evictions << "\r\n"
+            << " file_cache_entries " << st.entries << "\r\n"
+            << " file_cache_bytes " << st.bytes << "\r\n";
+    }
+    {
+        std::lock_guard<std::mutex> lock(rate_mutex_);
+        for (const auto& t : transfers_) {
+            if (viewer && t.second.session != viewer) continue;
+            out << " transfer " << t.second.desc << " rate " << t.first->rate() << " bytes " << t.first->bytes()
+                << "\r\n";
+        }
+    }
+    // Paths being served are other users' business
+    if (viewer) return out.str();
+    for (const OpenFileTable::FileStats& f : open_files_.activeFiles()) {
+        out << " file " << f.path << " active " << f.active << " transfers " << f.transfers
+            << " bytes_sent " << f.bytes_sent << "\r\n";
+    }
+    return out.str();
+}
+
+// Creates a hidden temp file next to target so the final rename stays on one
+// filesystem. Returns the fd, or -1 on error.
+int FtpServer::openTempFile(const PathTarget& target, std::string& temp_name) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    thread_local std::mt19937 rng(std::random_device{}());
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        temp_name = "." + target.name + ".part.";
+        for (int i = 0; i < 6; ++i) temp_name += chars[rng() % (sizeof(chars) - 1)];
+        int fd = openat(target.dirfd, temp_name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd != -1 || errno != EEXIST) return fd;
+    }
+    return -1;
+}
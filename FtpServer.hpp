@@ -6,37 +6,174 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
 
 #include "UserAuth.hpp"
+#include "CommandParser.hpp"
+#include "ServerConfig.hpp"
+#include "Session.hpp"
+#include "DirLister.hpp"
+#include "ListingCache.hpp"
+#include "PassivePortAllocator.hpp"
+#include "OpenFileTable.hpp"
+#include "FileCache.hpp"
+#include "PathResolver.hpp"
+#include "RateLimiter.hpp"
+#include "AdmissionControl.hpp"
+#include "HashIndex.hpp"
+#include "Tls.hpp"
 
 class FtpServer {
 public:
-    FtpServer(int port = 2121, const std::string& root_dir = "./ftp_root");
+    explicit FtpServer(const ServerConfig& config = ServerConfig());
     ~FtpServer();
     void run();
 
+    // Blocks the signals the server handles itself; call before starting any thread
+    static void blockSignals();
+
 private:
+    friend class EventLoop;
+
+    ServerConfig config_;
     int port_;
-    int server_fd_;
-    std::string root_dir_;
+    std::vector<ListenSpec> listeners_;
+    std::vector<int> listen_fds_;
+    PathResolver paths_;
     UserAuth userauth_;
+    ListingCache listing_cache_;
+    PassivePortAllocator pasv_ports_;
+    OpenFileTable open_files_;
+    FileCache file_cache_;
+    AdmissionControl admission_;
+    HashIndex hash_index_;
+    Tls tls_;
+
+    // Bandwidth limits and the transfers currently running, for SITE STATS
+    std::shared_ptr<TokenBucket> global_bucket_;
+    std::unordered_map<std::string, std::shared_ptr<TokenBucket>> user_buckets_;
+    struct TransferInfo {
+        const Session* session;
+        std::string desc; // client address, user, command
+    };
+    std::unordered_map<const Throttle*, TransferInfo> transfers_;
+    std::mutex rate_mutex_;
+
+    int createListenSocket(const ListenSpec& spec, bool reuse_port);
+    std::vector<int> createListenShards(const ListenSpec& spec, int shards);
+    void runThreadPerClient();
+    void acceptLoop(int listen_fd, int listener);
+    void runEventLoops();
+
+    // SIGUSR1 dumps metrics to the log, SIGHUP reloads the users file.
+    // Handled by a thread in sigwait, the signals are blocked everywhere
+    // else (see blockSignals).
+    void startSignalThread();
+    // Reloads the users file whenever it is written or replaced
+    void watchUsersFile();
+    void reloadUsers();
+    void serveMetrics(int listen_fd);
+    std::string metricsReport();
 
-    struct DataConn {
-        int listen_fd = -1;
-        int conn_fd = -1;
-        int port = 0;
-        bool ready = false;
+    // Returns false if the client was refused; it got a 421 and client_fd is closed
+    bool initSession(Session& session, int client_fd, const sockaddr_storage& client_addr, int listener);
+    // accept() failed with EMFILE/ENFILE: drops one pending client so the
+    // listener does not stay readable forever
+    static void shedConnection(int listen_fd);
+
+    void handleSession(Session& session);
+
+    // Session steps shared by the thread-per-client and event loop engines
+    void sendWelcome(Session& session);
+    void sendIdleTimeout(Session& session);
+    void sendBusy(Session& session);
+    enum class InputResult { Idle, Blocked, Closed };
+    static const size_t MAX_LINE_LENGTH = 8192;
+
+    // Appends what the control connection received to session.in_buffer.
+    // Returns the bytes added, 0 at EOF, -1 with errno set (EAGAIN: nothing
+    // complete yet, or the receive timeout).
+    ssize_t readControl(Session& session, bool dont_wait);
+    // Handles the complete lines buffered in session.in_buffer
+    InputResult processInput(Session& session, bool allow_blocking);
+    // True if command may block and must not run on an event loop thread
+    bool mayBlock(const Session& session, const Command& command) const;
+
+    // Command handlers return false when the session should end
+    using CommandHandler = bool (FtpServer::*)(Session&, const Command&);
+    struct CommandSpec {
+        CommandHandler handler = nullptr;
+        bool needs_login = true;
+        bool transfer = false; // blocks on the data connection
     };
+    static const CommandSpec& commandSpec(CommandId id);
+    bool processCommand(Session& session, const Command& command);
 
-    struct sockaddr_in addr;
-    socklen_t addrlen;
+    bool cmdUser(Session& session, const Command& command);
+    bool cmdPass(Session& session, const Command& command);
+    bool login(Session& session);
+    bool cmdQuit(Session& session, const Command& command);
+    bool cmdNoop(Session& session, const Command& command);
+    bool cmdPasv(Session& session, const Command& command);
+    bool cmdEpsv(Session& session, const Command& command);
+    bool cmdPort(Session& session, const Command& command);
+    bool cmdEprt(Session& session, const Command& command);
+    bool cmdList(Session& session, const Command& command);
+    bool cmdRetr(Session& session, const Command& command);
+    bool cmdStor(Session& session, const Command& command);
+    bool cmdRest(Session& session, const Command& command);
+    bool cmdRang(Session& session, const Command& command);
+    bool cmdSize(Session& session, const Command& command);
+    bool cmdType(Session& session, const Command& command);
+    bool cmdMode(Session& session, const Command& command);
+    bool cmdHash(Session& session, const Command& command);
+    bool cmdOpts(Session& session, const Command& command);
+    bool cmdAuth(Session& session, const Command& command);
+    bool cmdPbsz(Session& session, const Command& command);
+    bool cmdProt(Session& session, const Command& command);
+    bool cmdFeat(Session& session, const Command& command);
+    bool cmdAllo(Session& session, const Command& command);
+    bool cmdDele(Session& session, const Command& command);
+    bool cmdRnfr(Session& session, const Command& command);
+    bool cmdRnto(Session& session, const Command& command);
+    bool cmdMkd(Session& session, const Command& command);
+    bool cmdRmd(Session& session, const Command& command);
+    bool cmdCwd(Session& session, const Command& command);
+    bool cmdPwd(Session& session, const Command& command);
+    bool cmdSite(Session& session, const Command& command);
 
-    void handleSession(int client_fd, const std::string& client_ip, int client_port);
+    // Replies are queued and written together by flushReplies
+    void queueReply(Session& session, const std::string& reply);
+    bool flushReplies(Session& session);
+    void endSession(Session& session);
 
     // Helpers for data connection
+    int  openDataTransfer(Session& session);
+    bool setActiveDataConn(Session& session, const std::string& host, int port);
+    int  connectActiveDataConn(DataConn& dataconn);
+    std::string pasvAddress(const Session& session);
     bool openPassiveDataConn(DataConn& dataconn, int control_fd);
     int  acceptPassiveDataConn(DataConn& dataconn);
     void closeDataConn(DataConn& dataconn);
-    std::string resolvePath(const std::string& root, const std::string& user_path);
-    bool isPathAllowed(const std::string& root, const std::string& user_path);
+    void setDataTimeouts(int fd);
+    int  openTempFile(const PathTarget& target, std::string& temp_name);
+    bool openDataChannel(Session& session, int data_fd, DataChannel& channel);
+    ssize_t sendCompressed(Session& session, DataChannel& channel, int file_fd, const std::string& path,
+                           off_t offset, off_t length);
+    bool sendListing(const DirLister::Sink& sink, int dir_fd, const std::string& listdir, DirLister::Format format);
+    void invalidateCaches(const PathTarget& target);
+    static std::string quotePath(const std::string& path);
+    static ssize_t sendMapped(DataChannel& channel, const FileCache::Mapping& mapping, off_t offset,
+                              off_t length);
+
+    Throttle makeThrottle(const Session& session);
+    void registerTransfer(const Session& session, const Throttle& throttle, const Command& command);
+    void unregisterTransfer(const Throttle& throttle);
+
+    // Counter lines for SITE STATS
+    // viewer == nullptr: everything. Otherwise only the viewer's own
+    // transfers, unless it is one of stats_admins.
+    std::string statsReport(const Session* viewer = nullptr);
 };
@@ -0,0 +1,150 @@
+#include "HashIndex.hpp"
+#include "Logger.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+HashIndex::HashIndex(const std::string& path, size_t max_entries) : path_(path), max_entries_(max_entries) {
+    if (!enabled() || path_.empty()) return;
+    bool torn = load();
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Rewriting also drops a torn last line
+    if (torn || lines_ > 2 * entries_.size()) rewriteLocked();
+    if (fd_ != -1) return;
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+        Logger::log(Logger::WARNING, "Cannot open hash index " + path_ + ": " + strerror(errno));
+        return;
+    }
+    // The rewrite failed: end the torn line so the next append starts its own
+    if (torn && write(fd_, "\n", 1) != 1)
+        Logger::log(Logger::WARNING, "Hash index write failed: " + std::string(strerror(errno)));
+}
+
+HashIndex::~HashIndex() {
+    if (fd_ != -1) close(fd_);
+}
+
+// "dev ino size mtime algorithm first last", also the index file line
+// without its digest
+std::string HashIndex::makeKey(const struct stat& st, FileHash::Algorithm algorithm, off_t first, off_t last) {
+    return std::to_string(st.st_dev) + " " + std::to_string(st.st_ino) + " " + std::to_string(st.st_size) + " " +
+           std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec) + " " +
+           FileHash::name(algorithm) + " " + std::to_string(first) + " " + std::to_string(last);
+}
+
+bool HashIndex::lookup(const struct stat& st, FileHash::Algorithm algorithm, off_t first, off_t last,
+                       std::string& hex) {
+    std::string key = makeKey(st, algorithm, first, last);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        ++stats_.misses;
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    hex = it->second->hex;
+    ++stats_.hits;
+    return true;
+}
+
+void HashIndex::store(const struct stat& st, FileHash::Algorithm algorithm, off_t first, off_t last,
+                      const std::string& hex) {
+    std::string key = makeKey(st, algorithm, first, last);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.count(key)) return;
+    insertLocked(key, hex);
+    if (fd_ == -1) return;
+    std::string line = key + " " + hex + "\n";
+    if (write(fd_, line.data(), line.size()) != (ssize_t)line.size()) {
+        Logger::log(Logger::WARNING, "Hash index write failed: " + std::string(strerror(errno)));
+        return;
+    }
+    if (++lines_ > 2 * max_entries_) rewriteLocked();
+}
+
+HashIndex::Stats HashIndex::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s = stats_;
+    s.entries = entries_.size();
+    return s;
+}
+
+void HashIndex::insertLocked(const std::string& key, const std::string& hex) {
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        it->second->hex = hex;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    lru_.push_front(Entry{key, hex});
+    entries_[key] = lru_.begin();
+    if (entries_.size() > max_entries_) {
+        entries_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+}
+
+// Splits an index line into key and digest. False for anything makeKey and
+// Hasher::hex() could not have produced, e.g. a line torn by a crash.
+bool HashIndex::parseLine(const std::string& line, std::string& key, std::string& hex) {
+    if (line.empty() || line[0] == ' ') return false;
+    size_t fields = 1, algorithm_pos = 0;
+    for (size_t i = 0; i < line.size(); ++i) {
+        if (line[i] != ' ') continue;
+        if (i + 1 == line.size() || line[i + 1] == ' ') return false;
+        if (++fields == 5) algorithm_pos = i + 1;
+    }
+    if (fields != 8) return false;
+    size_t space = line.rfind(' ');
+    std::string_view name(line.data() + algorithm_pos, line.find(' ', algorithm_pos) - algorithm_pos);
+    FileHash::Algorithm algorithm;
+    if (!FileHash::parse(name, algorithm) || name != FileHash::name(algorithm)) return false;
+    if (line.size() - space - 1 != FileHash::hexLength(algorithm)) return false;
+    for (size_t i = space + 1; i < line.size(); ++i) {
+        if (!isdigit((unsigned char)line[i]) && (line[i] < 'a' || line[i] > 'f')) return false;
+    }
+    key = line.substr(0, space);
+    hex = line.substr(space + 1);
+    return true;
+}
+
+// Later lines win, so the file needs no locking against a crash mid-append.
+// Invalid lines are skipped. True if the file does not end in a newline.
+bool HashIndex::load() {
+    std::ifstream in(path_);
+    std::string line, key, hex;
+    bool torn = false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (std::getline(in, line)) {
+        ++lines_;
+        torn = in.eof();
+        if (parseLine(line, key, hex)) insertLocked(key, hex);
+    }
+    if (lines_ > 0) Logger::log(Logger::INFO, "Hash index " + path_ + ": " + std::to_string(entries_.size()) + " digests");
+    return torn;
+}
+
+// Writes the live entries, oldest first, to a temp file renamed over the index
+void HashIndex::rewriteLocked() {
+    std::string temp = path_ + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) return;
+    std::string data;
+    for (auto it = lru_.rbegin(); it != lru_.rend(); ++it) data += it->key + " " + it->hex + "\n";
+    bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    if (!ok || rename(temp.c_str(), path_.c_str()) == -1) {
+        close(fd);
+        unlink(temp.c_str());
+        return;
+    }
+    if (fd_ != -1) close(fd_);
+    // The temp fd now refers to the index; appends continue through it
+    fd_ = fd;
+    if (fcntl(fd_, F_SETFL, O_APPEND) == -1) Logger::log(Logger::WARNING, "Hash index: cannot set O_APPEND");
+    lines_ = entries_.size();
+}
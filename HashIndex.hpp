@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_map>
+
+#include "FileHash.hpp"
+
+// Digests of file ranges for HASH/XCRC, keyed on device, inode, size and
+// mtime so a changed file never matches an old entry. Bounded by
+// max_entries with LRU eviction. With a path, every new entry is appended
+// to an index file that is read back at startup; the file is rewritten
+// from memory once it holds twice as many lines as there are entries.
+class HashIndex {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t entries = 0;
+    };
+
+    HashIndex(const std::string& path = "", size_t max_entries = 0);
+    ~HashIndex();
+
+    bool enabled() const { return max_entries_ > 0; }
+
+    // Digest of bytes [first, last] of the file described by st
+    bool lookup(const struct stat& st, FileHash::Algorithm algorithm, off_t first, off_t last, std::string& hex);
+    void store(const struct stat& st, FileHash::Algorithm algorithm, off_t first, off_t last, const std::string& hex);
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::string hex;
+    };
+
+    std::string path_;
+    size_t max_entries_;
+    int fd_ = -1;
+    size_t lines_ = 0; // lines in the index file
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_; // front = most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+    Stats stats_;
+
+    static std::string makeKey(const struct stat& st, FileHash::Algorithm algorithm, off_t first, off_t last);
+    void insertLocked(const std::string& key, const std::string& hex);
+    static bool parseLine(const std::string& line, std::string& key, std::string& hex);
+    bool load();
+    void rewriteLocked();
+};
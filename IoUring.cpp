@@ -0,0 +1,133 @@
+#include "IoUring.hpp"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+static int ringSetup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int ringRegister(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+IoUring::IoUring(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd_ = ringSetup(entries, &params);
+    if (fd_ == -1) return;
+    sq_entries_ = params.sq_entries;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                    IORING_OFF_SQ_RING);
+    cq_ring_ = single ? sq_ring_
+                      : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                             IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED || sqes == MAP_FAILED) {
+        if (sq_ring_ == MAP_FAILED) sq_ring_ = nullptr;
+        if (cq_ring_ == MAP_FAILED) cq_ring_ = nullptr;
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size_);
+        release();
+        return;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    release();
+}
+
+void IoUring::release() {
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+    sqes_ = nullptr;
+    sq_ring_ = cq_ring_ = nullptr;
+    if (fd_ != -1) close(fd_);
+    fd_ = -1;
+}
+
+io_uring_sqe* IoUring::sqe() {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail_ + pending_;
+    if (tail - head >= sq_entries_) return nullptr;
+    unsigned index = tail & *sq_mask_;
+    io_uring_sqe* entry = &sqes_[index];
+    memset(entry, 0, sizeof(*entry));
+    sq_array_[index] = index;
+    ++pending_;
+    return entry;
+}
+
+bool IoUring::submitAndWait(unsigned wait_nr) {
+    unsigned submit = pending_;
+    if (submit > 0) {
+        __atomic_store_n(sq_tail_, *sq_tail_ + submit, __ATOMIC_RELEASE);
+        pending_ = 0;
+    }
+    while (submit > 0 || wait_nr > 0) {
+        int n = ringEnter(fd_, submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                // Entries the kernel took before the signal are not resubmitted
+                submit = *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+                continue;
+            }
+            return false;
+        }
+        submit -= std::min<unsigned>(submit, n);
+        if (submit == 0) break;
+    }
+    return true;
+}
+
+bool IoUring::registerBuffers(const iovec* iov, unsigned count) {
+    return ringRegister(fd_, IORING_REGISTER_BUFFERS, iov, count) == 0;
+}
+
+bool IoUring::registerFiles(const int* fds, unsigned count) {
+    return ringRegister(fd_, IORING_REGISTER_FILES, fds, count) == 0;
+}
+
+bool IoUring::updateFiles(unsigned offset, const int* fds, unsigned count) {
+    io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = offset;
+    update.fds = reinterpret_cast<uintptr_t>(fds);
+    return ringRegister(fd_, IORING_REGISTER_FILES_UPDATE, &update, count) == (int)count;
+}
+
+bool IoUring::supported() {
+    static const bool result = []() {
+        IoUring probe(2);
+        return probe.ok();
+    }();
+    return result;
+}
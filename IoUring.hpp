@@ -0,0 +1,62 @@
+#pragma once
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#include <cstddef>
+
+// Minimal io_uring on the raw system calls, liburing is not required. One
+// submission and one completion queue, used by a single thread.
+class IoUring {
+public:
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool ok() const { return fd_ != -1; }
+
+    // Next free submission entry, zeroed. nullptr when the queue is full.
+    io_uring_sqe* sqe();
+    // Submits the queued entries and waits until at least wait_nr completions
+    // are available. Returns false on error (errno set).
+    bool submitAndWait(unsigned wait_nr);
+
+    // Calls fn(const io_uring_cqe&) for every available completion
+    template <class Fn>
+    void reap(Fn fn) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) fn(cqes_[head & *cq_mask_]);
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    bool registerBuffers(const iovec* iov, unsigned count);
+    // Registers count slots, -1 leaves a slot empty
+    bool registerFiles(const int* fds, unsigned count);
+    bool updateFiles(unsigned offset, const int* fds, unsigned count);
+
+    // True if the kernel lets this process create rings. Probed once.
+    static bool supported();
+
+private:
+    int fd_ = -1;
+    unsigned sq_entries_ = 0;
+    unsigned pending_ = 0; // queued but not yet submitted
+
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr; // == sq_ring_ with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+
+    void release();
+};
@@ -0,0 +1,193 @@
+#include "ListingCache.hpp"
+#include "Logger.hpp"
+
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+// Upper bound on inotify watches held for directories without cached entries
+static const size_t MAX_WATCHES = 4096;
+
+ListingCache::ListingCache(size_t max_bytes)
+    : max_bytes_(max_bytes), inotify_fd_(-1), wake_fd_(-1) {
+    if (max_bytes_ == 0) return;
+
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (inotify_fd_ == -1 || wake_fd_ == -1) {
+        Logger::log(Logger::WARNING, "inotify unavailable, listing cache disabled");
+        if (inotify_fd_ != -1) close(inotify_fd_);
+        if (wake_fd_ != -1) close(wake_fd_);
+        inotify_fd_ = wake_fd_ = -1;
+        max_bytes_ = 0;
+        return;
+    }
+    watcher_ = std::thread(&ListingCache::watchLoop, this);
+}
+
+ListingCache::~ListingCache() {
+    if (watcher_.joinable()) {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) == sizeof(one)) watcher_.join();
+        else watcher_.detach();
+    }
+    if (inotify_fd_ != -1) close(inotify_fd_);
+    if (wake_fd_ != -1) close(wake_fd_);
+}
+
+std::string ListingCache::makeKey(const std::string& dir, DirLister::Format format) {
+    return std::to_string(format) + ":" + dir;
+}
+
+bool ListingCache::lookup(const std::string& dir, DirLister::Format format, std::string& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(makeKey(dir, format));
+    if (it == entries_.end()) {
+        ++stats_.misses;
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    out = it->second->data;
+    ++stats_.hits;
+    return true;
+}
+
+uint64_t ListingCache::prepare(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = watches_.find(dir);
+    if (it != watches_.end()) return it->second.generation;
+
+    if (watches_.size() >= MAX_WATCHES) {
+        // Drop watches of directories with nothing cached
+        for (auto w = watches_.begin(); w != watches_.end();) {
+            auto next = std::next(w);
+            if (w->second.entries == 0) removeWatchLocked(w->first);
+            w = next;
+        }
+    }
+
+    int wd = inotify_add_watch(inotify_fd_, dir.c_str(), WATCH_MASK);
+    if (wd == -1) {
+        Logger::log(Logger::WARNING, "inotify_add_watch " + dir + " failed: " + strerror(errno));
+        return 0;
+    }
+    Watch& watch = watches_[dir];
+    watch.wd = wd;
+    watch.generation = ++next_generation_;
+    wd_dirs_[wd] = dir;
+    return watch.generation;
+}
+
+void ListingCache::store(const std::string& dir, DirLister::Format format, uint64_t token, std::string data) {
+    if (token == 0 || data.size() > maxEntrySize()) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto wit = watches_.find(dir);
+    if (wit == watches_.end() || wit->second.generation != token) return; // changed while rendering
+
+    std::string key = makeKey(dir, format);
+    auto old = entries_.find(key);
+    if (old != entries_.end()) eraseLocked(old->second);
+
+    while (!lru_.empty() && stats_.bytes + data.size() > max_bytes_) {
+        auto victim = std::prev(lru_.end());
+        std::string victim_dir = victim->dir;
+        eraseLocked(victim);
+        ++stats_.evictions;
+        // Evicted directories stop being watched; invalidated ones keep
+        // their watch since they are likely to be listed again soon
+        auto vw = watches_.find(victim_dir);
+        if (vw != watches_.end() && vw->second.entries == 0 && victim_dir != dir) removeWatchLocked(victim_dir);
+    }
+    stats_.bytes += data.size();
+    lru_.push_front(Entry{key, dir, std::move(data)});
+    entries_[key] = lru_.begin();
+    ++watches_[dir].entries;
+}
+
+void ListingCache::invalidate(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    invalidateLocked(dir);
+}
+
+void ListingCache::invalidateLocked(const std::string& dir) {
+    auto wit = watches_.find(dir);
+    if (wit == watches_.end()) return;
+    wit->second.generation = ++next_generation_;
+    for (int format : {DirLister::LIST, DirLister::NLST, DirLister::MLSD}) {
+        auto it = entries_.find(makeKey(dir, static_cast<DirLister::Format>(format)));
+        if (it != entries_.end()) {
+            eraseLocked(it->second);
+            ++stats_.invalidations;
+        }
+    }
+}
+
+void ListingCache::eraseLocked(std::list<Entry>::iterator it) {
+    stats_.bytes -= it->data.size();
+    auto wit = watches_.find(it->dir);
+    if (wit != watches_.end()) --wit->second.entries;
+    entries_.erase(it->key);
+    lru_.erase(it);
+}
+
+void ListingCache::removeWatchLocked(const std::string& dir) {
+    auto wit = watches_.find(dir);
+    if (wit == watches_.end()) return;
+    inotify_rm_watch(inotify_fd_, wit->second.wd);
+    wd_dirs_.erase(wit->second.wd);
+    watches_.erase(wit);
+}
+
+ListingCache::Stats ListingCache::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s = stats_;
+    s.entries = entries_.size();
+    return s;
+}
+
+void ListingCache::watchLoop() {
+    alignas(inotify_event) char buf[16 * 1024];
+    pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            Logger::log(Logger::ERROR, "Listing cache watcher poll failed");
+            return;
+        }
+        if (fds[1].revents) return;
+
+        ssize_t n = read(inotify_fd_, buf, sizeof(buf));
+        if (n <= 0) continue;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (char* p = buf; p < buf + n;) {
+            auto* ev = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Events were lost, nothing cached can be trusted
+                for (auto& w : watches_) invalidateLocked(w.first);
+                continue;
+            }
+            auto dit = wd_dirs_.find(ev->wd);
+            if (dit == wd_dirs_.end()) continue;
+            std::string dir = dit->second;
+            invalidateLocked(dir);
+            if (ev->mask & IN_IGNORED) {
+                // Directory is gone, the kernel dropped the watch
+                watches_.erase(dir);
+                wd_dirs_.erase(dit);
+            } else if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) {
+                // The watch follows the inode, not the path. Drop it so the
+                // next prepare() watches whatever sits at the path then.
+                removeWatchLocked(dir);
+            }
+        }
+    }
+}
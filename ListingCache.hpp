@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "DirLister.hpp"
+
+// Caches rendered LIST/NLST/MLSD output per resolved directory path. Every
+// cached directory has an inotify watch; any change in it drops its entries.
+// Total size is bounded by max_bytes with LRU eviction.
+class ListingCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+
+    explicit ListingCache(size_t max_bytes = 0);
+    ~ListingCache();
+
+    bool enabled() const { return max_bytes_ > 0; }
+
+    // Copies the cached listing into out, returns false on a miss
+    bool lookup(const std::string& dir, DirLister::Format format, std::string& out);
+
+    // Call before rendering a listing. Starts watching dir and returns a
+    // token for store(), which drops the result if dir changed in between.
+    uint64_t prepare(const std::string& dir);
+    void store(const std::string& dir, DirLister::Format format, uint64_t token, std::string data);
+
+    // Drops all cached listings of dir
+    void invalidate(const std::string& dir);
+
+    // Largest single listing worth caching
+    size_t maxEntrySize() const { return max_bytes_ / 4; }
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::string dir;
+        std::string data;
+    };
+    struct Watch {
+        int wd = -1;
+        uint64_t generation = 0;
+        int entries = 0;
+    };
+
+    size_t max_bytes_;
+    int inotify_fd_;
+    int wake_fd_;
+    std::thread watcher_;
+
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_; // front = most recently used
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+    std::unordered_map<std::string, Watch> watches_;
+    std::unordered_map<int, std::string> wd_dirs_;
+    uint64_t next_generation_ = 0;
+    Stats stats_;
+
+    static std::string makeKey(const std::string& dir, DirLister::Format format);
+    void invalidateLocked(const std::string& dir);
+    void eraseLocked(std::list<Entry>::iterator it);
+    void removeWatchLocked(const std::string& dir);
+    void watchLoop();
+};
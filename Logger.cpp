@@ -1,12 +1,83 @@
 #include "Logger.hpp"
 #include <iostream>
 #include <ctime>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 
 std::ofstream Logger::log_file_;
 bool Logger::file_enabled_ = false;
 std::mutex Logger::log_mutex_;
 
+namespace {
+
+struct LogEntry {
+    Logger::Level level = Logger::INFO;
+    std::time_t time = 0;
+    std::string msg; // keeps its capacity, so steady state logging does not allocate
+};
+
+// Single producer (the owning thread), single consumer (the writer thread)
+struct Ring {
+    explicit Ring(size_t capacity) : slots(capacity) {}
+    std::vector<LogEntry> slots;
+    std::atomic<size_t> head{0}; // next slot the producer fills
+    std::atomic<size_t> tail{0}; // next slot the writer drains
+    std::atomic<bool> retired{false}; // owning thread exited, recycled once drained
+};
+
+std::atomic<bool> async_enabled{false};
+size_t ring_entries = 4096;
+std::mutex rings_mutex; // guards rings and free_rings, taken on ring registration and by the writer
+std::vector<Ring*> rings;
+// Drained rings of exited threads. Worker threads come and go with every
+// transfer, so their rings are reused rather than allocated each time.
+std::vector<Ring*> free_rings;
+std::thread writer;
+std::atomic<bool> writer_stop{false};
+std::atomic<uint64_t> dropped{0};
+
+// Marks the thread's ring for reclamation when the thread exits. Logging
+// from later thread_local destructors goes through the synchronous path.
+struct RingOwner {
+    Ring* ring = nullptr;
+    bool exited = false;
+    ~RingOwner() {
+        if (ring) ring->retired.store(true, std::memory_order_release);
+        ring = nullptr;
+        exited = true;
+    }
+};
+thread_local RingOwner ring_owner;
+
+// nullptr once the thread is exiting
+Ring* threadRing() {
+    if (!ring_owner.ring && !ring_owner.exited) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        if (free_rings.empty()) {
+            ring_owner.ring = new Ring(ring_entries);
+        } else {
+            ring_owner.ring = free_rings.back();
+            free_rings.pop_back();
+        }
+        rings.push_back(ring_owner.ring);
+    }
+    return ring_owner.ring;
+}
+
+const char* levelString(Logger::Level level) {
+    switch (level) {
+        case Logger::INFO:      return "[INFO] ";
+        case Logger::WARNING:   return "[WARN] ";
+        case Logger::ERROR:     return "[ERROR] ";
+    }
+    return "";
+}
+
+} // namespace
+
 void Logger::init(const std::string& filename) {
     std::lock_guard<std::mutex> lock(log_mutex_);
     if (!filename.empty()) {
@@ -20,7 +91,19 @@ void Logger::init(const std::string& filename) {
     }
 }
 
+void Logger::startAsync(size_t entries) {
+    if (async_enabled.load()) return;
+    ring_entries = entries > 0 ? entries : 4096;
+    writer_stop.store(false);
+    writer = std::thread(&Logger::writerLoop);
+    async_enabled.store(true, std::memory_order_release);
+}
+
 void Logger::close() {
+    if (async_enabled.exchange(false)) {
+        writer_stop.store(true);
+        writer.join();
+    }
     std::lock_guard<std::mutex> lock(log_mutex_);
     if (file_enabled_) {
         log_file_.close();
@@ -28,22 +111,46 @@ void Logger::close() {
     }
 }
 
-void Logger::log(Level level, const std::string& msg) {
-    std::lock_guard<std::mutex> lock(log_mutex_);
+uint64_t Logger::droppedCount() {
+    return dropped.load(std::memory_order_relaxed);
+}
 
-    // Get timestamp
-    std::time_t now = std::time(nullptr);
-    char tbuf[32];
-    std::strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+void Logger::formatLine(std::string& out, Level level, std::time_t when, const std::string& msg) {
+    // localtime/strftime only run once per second of log time
+    thread_local std::time_t cached_time = -1;
+    thread_local char tbuf[32];
+    if (when != cached_time) {
+        std::tm tm;
+        localtime_r(&when, &tm);
+        std::strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_time = when;
+    }
+    out.append("[").append(tbuf).append("] ").append(levelString(level)).append(msg).append("\n");
+}
 
+void Logger::log(Level level, const std::string& msg) {
+    std::time_t now = std::time(nullptr);
 
-    const char* level_str = "";
-    switch (level) {
-        case INFO:      level_str = "[INFO] "; break;
-        case WARNING:   level_str = "[WARN] "; break;
-        case ERROR:     level_str = "[ERROR] "; break;
+    Ring* ring = async_enabled.load(std::memory_order_acquire) ? threadRing() : nullptr;
+    if (ring) {
+        size_t head = ring->head.load(std::memory_order_relaxed);
+        size_t tail = ring->tail.load(std::memory_order_acquire);
+        if (head - tail >= ring->slots.size()) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        LogEntry& entry = ring->slots[head % ring->slots.size()];
+        entry.level = level;
+        entry.time = now;
+        entry.msg.assign(msg);
+        ring->head.store(head + 1, std::memory_order_release);
+        return;
     }
-    std::string out = std::string("[") + tbuf + "] " + level_str + msg;
+
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    std::string out;
+    formatLine(out, level, now, msg);
+    out.pop_back();
 
     // Log to console
     std::cout << out << std::endl;
@@ -53,3 +160,56 @@ void Logger::log(Level level, const std::string& msg) {
         log_file_ << out << std::endl;
     }
 }
+
+// Drains all rings into one batch and writes it with a single flush per sink
+void Logger::writerLoop() {
+    std::string batch;
+    uint64_t reported_drops = 0;
+    while (true) {
+        bool stopping = writer_stop.load();
+        batch.clear();
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            for (size_t i = 0; i < rings.size();) {
+                Ring* ring = rings[i];
+                // Check retired first so entries pushed before the exit are drained
+                bool retired = ring->retired.load(std::memory_order_acquire);
+                size_t tail = ring->tail.load(std::memory_order_relaxed);
+                size_t head = ring->head.load(std::memory_order_acquire);
+                for (; tail != head; ++tail) {
+                    const LogEntry& entry = ring->slots[tail % ring->slots.size()];
+                    formatLine(batch, entry.level, entry.time, entry.msg);
+                }
+                ring->tail.store(tail, std::memory_order_release);
+                if (retired) {
+                    ring->retired.store(false, std::memory_order_relaxed);
+                    free_rings.push_back(ring);
+                    rings[i] = rings.back();
+                    rings.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+        }
+        uint64_t drops = dropped.load(std::memory_order_relaxed);
+        if (drops != reported_drops) {
+            formatLine(batch, WARNING, std::time(nullptr),
+                       "Logger dropped " + std::to_string(drops - reported_drops) + " messages");
+            reported_drops = drops;
+        }
+
+        if (!batch.empty()) {
+            std::lock_guard<std::mutex> lock(log_mutex_);
+            std::cout.write(batch.data(), batch.size());
+            std::cout.flush();
+            if (file_enabled_) {
+                log_file_.write(batch.data(), batch.size());
+                log_file_.flush();
+            }
+        } else if (stopping) {
+            return;
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+}
@@ -2,6 +2,8 @@
 #include <string>
 #include <fstream>
 #include <mutex>
+#include <cstdint>
+#include <ctime>
 
 class Logger {
 public:
@@ -10,8 +12,16 @@ public:
      // Initialize with optional log file name; call once at program start
     static void init(const std::string& filename = "");
 
+    // Switch to asynchronous logging: log() pushes into a per-thread ring
+    // buffer and a background thread writes batches. A full ring drops the
+    // message and counts it instead of blocking the caller.
+    static void startAsync(size_t ring_entries = 4096);
+
     static void log(Level level, const std::string& msg);
 
+    // Messages dropped because a ring buffer was full
+    static uint64_t droppedCount();
+
     // Close the log file when done (optional, called by main)
     static void close();
 
@@ -19,4 +29,7 @@ private:
     static std::ofstream log_file_;
     static bool file_enabled_;
     static std::mutex log_mutex_;
+
+    static void formatLine(std::string& out, Level level, std::time_t when, const std::string& msg);
+    static void writerLoop();
 };
@@ -0,0 +1,192 @@
+#include "Metrics.hpp"
+
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+struct HistogramData {
+    std::atomic<uint64_t> buckets[Metrics::BUCKETS] = {};
+    std::atomic<uint64_t> overflow{0}; // above the last bucket
+    std::atomic<uint64_t> sum{0};
+};
+
+const size_t COMMAND_COUNT = static_cast<size_t>(CommandId::Count);
+
+struct Shard {
+    std::atomic<uint64_t> counters[Metrics::CounterCount] = {};
+    HistogramData histograms[Metrics::HistogramCount];
+    HistogramData commands[COMMAND_COUNT];
+};
+
+// Only the owning thread writes its shard, so a plain load and store is enough
+inline void bump(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void record(HistogramData& h, uint64_t value) {
+    // Smallest i with value <= 2^i
+    int bucket = value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+    bump(bucket < Metrics::BUCKETS ? h.buckets[bucket] : h.overflow, 1);
+    bump(h.sum, value);
+}
+
+void merge(HistogramData& into, const HistogramData& from) {
+    for (int i = 0; i < Metrics::BUCKETS; ++i)
+        into.buckets[i].fetch_add(from.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    into.overflow.fetch_add(from.overflow.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    into.sum.fetch_add(from.sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void merge(Shard& into, const Shard& from) {
+    for (int i = 0; i < Metrics::CounterCount; ++i)
+        into.counters[i].fetch_add(from.counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    for (int i = 0; i < Metrics::HistogramCount; ++i) merge(into.histograms[i], from.histograms[i]);
+    for (size_t i = 0; i < COMMAND_COUNT; ++i) merge(into.commands[i], from.commands[i]);
+}
+
+std::mutex shards_mutex; // guards shards and retired, taken on thread start/exit and by render
+std::vector<Shard*> shards;
+Shard retired;
+
+struct ShardOwner {
+    Shard* shard = nullptr;
+    ~ShardOwner() {
+        if (!shard) return;
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        merge(retired, *shard);
+        for (size_t i = 0; i < shards.size(); ++i) {
+            if (shards[i] == shard) {
+                shards[i] = shards.back();
+                shards.pop_back();
+                break;
+            }
+        }
+        delete shard;
+    }
+};
+thread_local ShardOwner shard_owner;
+
+Shard& threadShard() {
+    if (!shard_owner.shard) {
+        Shard* shard = new Shard();
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        shards.push_back(shard);
+        shard_owner.shard = shard;
+    }
+    return *shard_owner.shard;
+}
+
+const char* const counter_names[Metrics::CounterCount][2] = {
+    {"ftp_sessions_accepted_total", "Control connections accepted"},
+    {"ftp_sessions_rejected_total", "Control connections refused by admission control"},
+    {"ftp_commands_total", "Commands handled"},
+    {"ftp_auth_failures_total", "Failed logins"},
+    {"ftp_transfers_ok_total", "RETR and STOR transfers completed"},
+    {"ftp_transfers_failed_total", "RETR and STOR transfers aborted"},
+    {"ftp_bytes_sent_total", "File bytes sent by RETR"},
+    {"ftp_bytes_received_total", "File bytes received by STOR and APPE"},
+};
+
+void writeHistogram(std::ostringstream& out, const char* name, const std::string& labels, const HistogramData& h,
+                    double scale) {
+    // Only the range of buckets in use is written; cumulative counts make
+    // the ones left out implicit
+    int first = Metrics::BUCKETS, last = -1;
+    for (int i = 0; i < Metrics::BUCKETS; ++i) {
+        if (h.buckets[i].load(std::memory_order_relaxed) == 0) continue;
+        if (first == Metrics::BUCKETS) first = i;
+        last = i;
+    }
+    uint64_t cumulative = 0;
+    std::string sep = labels.empty() ? "" : ",";
+    for (int i = first; i <= last; ++i) {
+        cumulative += h.buckets[i].load(std::memory_order_relaxed);
+        out << name << "_bucket{" << labels << sep << "le=\"" << (double)(1ULL << i) * scale << "\"} " << cumulative
+            << "\n";
+    }
+    cumulative += h.overflow.load(std::memory_order_relaxed);
+    out << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << cumulative << "\n";
+    out << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " "
+        << (double)h.sum.load(std::memory_order_relaxed) * scale << "\n";
+    out << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << cumulative << "\n";
+}
+
+} // namespace
+
+void Metrics::add(Counter counter, uint64_t n) {
+    bump(threadShard().counters[counter], n);
+}
+
+void Metrics::observe(Histogram histogram, uint64_t value) {
+    record(threadShard().histograms[histogram], value);
+}
+
+static uint64_t microsSince(Metrics::Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Metrics::Clock::now() - start).count();
+}
+
+void Metrics::observeSince(Histogram histogram, Clock::time_point start) {
+    observe(histogram, microsSince(start));
+}
+
+void Metrics::observeCommand(CommandId id, Clock::time_point start) {
+    Shard& shard = threadShard();
+    bump(shard.counters[Commands], 1);
+    record(shard.commands[static_cast<size_t>(id)], microsSince(start));
+}
+
+void Metrics::recordTransfer(bool send, int64_t bytes, Clock::time_point start) {
+    Shard& shard = threadShard();
+    if (bytes < 0) {
+        bump(shard.counters[TransfersFailed], 1);
+        return;
+    }
+    bump(shard.counters[TransfersOk], 1);
+    bump(shard.counters[send ? BytesSent : BytesReceived], bytes);
+    uint64_t micros = microsSince(start);
+    if (micros > 0) record(shard.histograms[send ? SendThroughput : ReceiveThroughput], bytes * 1000000 / micros);
+}
+
+std::string Metrics::render() {
+    Shard total;
+    {
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        merge(total, retired);
+        for (const Shard* shard : shards) merge(total, *shard);
+    }
+
+    std::ostringstream out;
+    for (int i = 0; i < CounterCount; ++i) {
+        out << "# HELP " << counter_names[i][0] << " " << counter_names[i][1] << "\n"
+            << "# TYPE " << counter_names[i][0] << " counter\n"
+            << counter_names[i][0] << " " << total.counters[i].load(std::memory_order_relaxed) << "\n";
+    }
+
+    out << "# HELP ftp_command_duration_seconds Time to handle a command, transfers included\n"
+        << "# TYPE ftp_command_duration_seconds histogram\n";
+    for (size_t i = 0; i < COMMAND_COUNT; ++i) {
+        const HistogramData& h = total.commands[i];
+        uint64_t count = h.overflow.load(std::memory_order_relaxed);
+        for (const auto& bucket : h.buckets) count += bucket.load(std::memory_order_relaxed);
+        if (count == 0) continue;
+        CommandId id = static_cast<CommandId>(i);
+        std::string verb = id == CommandId::Unknown ? "unknown" : CommandParser::name(id);
+        writeHistogram(out, "ftp_command_duration_seconds", "verb=\"" + verb + "\"", h, 1e-6);
+    }
+
+    out << "# HELP ftp_pasv_setup_seconds Time to open a passive data socket\n"
+        << "# TYPE ftp_pasv_setup_seconds histogram\n";
+    writeHistogram(out, "ftp_pasv_setup_seconds", "", total.histograms[PasvSetup], 1e-6);
+    out << "# HELP ftp_auth_duration_seconds Time to check a password\n"
+        << "# TYPE ftp_auth_duration_seconds histogram\n";
+    writeHistogram(out, "ftp_auth_duration_seconds", "", total.histograms[Auth], 1e-6);
+    out << "# HELP ftp_transfer_throughput_bytes_per_second Average rate of completed transfers\n"
+        << "# TYPE ftp_transfer_throughput_bytes_per_second histogram\n";
+    writeHistogram(out, "ftp_transfer_throughput_bytes_per_second", "direction=\"send\"",
+                   total.histograms[SendThroughput], 1);
+    writeHistogram(out, "ftp_transfer_throughput_bytes_per_second", "direction=\"receive\"",
+                   total.histograms[ReceiveThroughput], 1);
+    return out.str();
+}
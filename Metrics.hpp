@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "CommandParser.hpp"
+
+// Process-wide counters and histograms, exported in the Prometheus text
+// format. Every thread writes only its own shard (a relaxed load and store,
+// no locked instructions); render() sums the shards. Shards of exited
+// threads are folded into a retired total so no counts are lost.
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum Counter {
+        SessionsAccepted,
+        SessionsRejected,
+        Commands,
+        AuthFailures,
+        TransfersOk,
+        TransfersFailed,
+        BytesSent,
+        BytesReceived,
+        CounterCount
+    };
+
+    // Latencies are recorded in microseconds, throughput in bytes per second
+    enum Histogram {
+        PasvSetup,
+        Auth,
+        SendThroughput,
+        ReceiveThroughput,
+        HistogramCount
+    };
+
+    // Power-of-two buckets: bucket i counts values in (2^(i-1), 2^i]. Larger
+    // values only show up in +Inf.
+    static const int BUCKETS = 40;
+
+    static void add(Counter counter, uint64_t n = 1);
+    static void observe(Histogram histogram, uint64_t value);
+    static void observeSince(Histogram histogram, Clock::time_point start);
+    static void observeCommand(CommandId id, Clock::time_point start);
+    // Counts one finished RETR (send) or STOR (receive)
+    static void recordTransfer(bool send, int64_t bytes, Clock::time_point start);
+
+    // All metrics in the Prometheus text exposition format
+    static std::string render();
+};
@@ -0,0 +1,19 @@
+#pragma once
+#include <sys/socket.h>
+#include <string>
+
+// IPv4/IPv6 address helpers
+class NetUtil {
+public:
+    // Parses a numeric IPv4 or IPv6 address ("[::1]" brackets allowed)
+    static bool parseAddress(const std::string& host, int port, sockaddr_storage& out, socklen_t& len);
+
+    // Numeric address without port. IPv4-mapped IPv6 addresses come back as IPv4.
+    static std::string addressString(const sockaddr_storage& addr);
+    static int port(const sockaddr_storage& addr);
+    static void setPort(sockaddr_storage& addr, int port);
+    static socklen_t length(const sockaddr_storage& addr);
+
+    // True if both addresses are the same host (ports ignored)
+    static bool sameHost(const sockaddr_storage& a, const sockaddr_storage& b);
+};
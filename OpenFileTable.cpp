@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "OpenFileTable.hpp"
+#include "Logger.hpp"
+
+OpenFileTable::OpenFile::~OpenFile() {
+    if (fd != -1) close(fd);
+    if (transfers > 1) {
+        Logger::log(Logger::INFO, "Closed " + path + ": " + std::to_string(transfers.load()) +
+                                      " transfers, " + std::to_string(bytes_sent.load()) + " bytes sent");
+    }
+}
+
+static bool sameFile(const OpenFileTable::OpenFile& file, const struct stat& st) {
+    return file.dev == st.st_dev && file.ino == st.st_ino && file.size == st.st_size &&
+           file.mtime.tv_sec == st.st_mtim.tv_sec && file.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+OpenFileTable::Handle OpenFileTable::acquire(const std::string& path, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = files_.find(path);
+    if (it != files_.end()) {
+        Handle file = it->second.lock();
+        if (file && sameFile(*file, st)) {
+            close(fd);
+            return file;
+        }
+    }
+
+    Handle file = std::make_shared<OpenFile>();
+    file->path = path;
+    file->fd = fd;
+    if (!S_ISREG(st.st_mode)) return file; // pipes and devices are never shared
+
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->mtime = st.st_mtim;
+    file->size = st.st_size;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (files_.size() >= SWEEP_THRESHOLD) {
+        for (auto e = files_.begin(); e != files_.end();) {
+            if (e->second.expired()) e = files_.erase(e);
+            else ++e;
+        }
+    }
+    files_[path] = file;
+    return file;
+}
+
+void OpenFileTable::beginTransfer(OpenFile& file, off_t offset, off_t length) {
+    ++file.active;
+    ++file.transfers;
+    // Start reading the segment before the data connection asks for it. The
+    // first window is enough, sequential readahead takes over from there.
+    const off_t window = 4 << 20;
+    if (file.size > 0 && offset < file.size) {
+        off_t len = length < 0 ? file.size - offset : length;
+        posix_fadvise(file.fd, offset, std::min(len, window), POSIX_FADV_WILLNEED);
+    }
+}
+
+void OpenFileTable::endTransfer(OpenFile& file, ssize_t sent) {
+    if (sent > 0) file.bytes_sent += sent;
+    --file.active;
+}
+
+std::vector<OpenFileTable::FileStats> OpenFileTable::activeFiles() const {
+    std::vector<FileStats> result;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& e : files_) {
+        Handle file = e.second.lock();
+        if (file && file->active > 0)
+            result.push_back({file->path, file->active.load(), file->transfers.load(), file->bytes_sent.load()});
+    }
+    return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// Shares one read-only fd per file between concurrent RETRs. Segmented
+// downloads open several data connections for ranges of the same file; with
+// a shared fd they share one readahead context and one page cache footprint,
+// and transfers are accounted per file rather than per connection.
+class OpenFileTable {
+public:
+    struct OpenFile {
+        std::string path;
+        int fd = -1;
+        dev_t dev = 0;
+        ino_t ino = 0;
+        struct timespec mtime {};
+        off_t size = 0;
+        std::atomic<int> active{0};        // transfers running right now
+        std::atomic<uint64_t> transfers{0}; // transfers started
+        std::atomic<uint64_t> bytes_sent{0};
+
+        ~OpenFile();
+    };
+    using Handle = std::shared_ptr<OpenFile>;
+
+    struct FileStats {
+        std::string path;
+        int active;
+        uint64_t transfers;
+        uint64_t bytes_sent;
+    };
+
+    // Returns the shared file for path. fd is a fresh read-only descriptor
+    // of it; it is kept if no transfer holds the file or the file was
+    // replaced since, and closed otherwise. nullptr if fd is unusable.
+    Handle acquire(const std::string& path, int fd);
+
+    // Brackets one transfer of [offset, offset + length) of the file; begin
+    // hints the kernel to read the segment ahead.
+    static void beginTransfer(OpenFile& file, off_t offset, off_t length);
+    static void endTransfer(OpenFile& file, ssize_t sent);
+
+    // Files with a transfer running
+    std::vector<FileStats> activeFiles() const;
+
+private:
+    static const size_t SWEEP_THRESHOLD = 1024;
+
+    std::unordered_map<std::string, std::weak_ptr<OpenFile>> files_;
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,49 @@
+#include "PassivePortAllocator.hpp"
+
+PassivePortAllocator::PassivePortAllocator(int min_port, int max_port)
+    : min_port_(min_port),
+      size_(max_port >= min_port ? max_port - min_port + 1 : 0),
+      used_((size_ + 63) / 64, 0),
+      rng_(std::random_device{}()) {
+    // Bits past the end of the range are permanently taken
+    if (size_ % 64 != 0) used_.back() = ~0ULL << (size_ % 64);
+}
+
+int PassivePortAllocator::acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (in_use_ >= size_) return 0;
+
+    size_t start = rng_() % size_;
+    size_t words = used_.size();
+    size_t word = start / 64;
+    // First word only from the start bit on, then whole words, wrapping once
+    uint64_t mask = ~0ULL << (start % 64);
+    for (size_t n = 0; n <= words; ++n) {
+        uint64_t free_bits = ~used_[word] & mask;
+        if (free_bits) {
+            int bit = __builtin_ctzll(free_bits);
+            used_[word] |= 1ULL << bit;
+            ++in_use_;
+            return min_port_ + static_cast<int>(word * 64 + bit);
+        }
+        word = (word + 1) % words;
+        mask = ~0ULL;
+    }
+    return 0;
+}
+
+void PassivePortAllocator::release(int port) {
+    if (port < min_port_ || port >= min_port_ + (int)size_) return;
+    size_t index = port - min_port_;
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint64_t bit = 1ULL << (index % 64);
+    if (used_[index / 64] & bit) {
+        used_[index / 64] &= ~bit;
+        --in_use_;
+    }
+}
+
+size_t PassivePortAllocator::inUse() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_use_;
+}
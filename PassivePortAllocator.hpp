@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <vector>
+
+// Hands out passive data ports from [min_port, max_port]. A bitmap tracks the
+// ports held by sessions so PASV does not have to probe the range with
+// failing bind() calls, and each search starts at a random position so ports
+// are not predictable and concurrent sessions do not pile onto the low end.
+class PassivePortAllocator {
+public:
+    PassivePortAllocator(int min_port = 20000, int max_port = 21000);
+
+    // Returns a free port marked as in use, or 0 if the range is exhausted
+    int acquire();
+    void release(int port);
+
+    size_t inUse() const;
+    size_t capacity() const { return size_; }
+
+private:
+    int min_port_;
+    size_t size_;
+    std::vector<uint64_t> used_; // bit i set = min_port_ + i is taken
+    size_t in_use_ = 0;
+    std::mt19937 rng_;
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,283 @@
+#include "PathResolver.hpp"
+#include "ErrorHandler.hpp"
+#include "Logger.hpp"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+void DirHandleCache::clear() {
+    for (Entry& e : entries_) close(e.fd);
+    entries_.clear();
+}
+
+WorkingDir::WorkingDir(WorkingDir&& other)
+    : fd_(other.fd_), path_(std::move(other.path_)), abs_(std::move(other.abs_)), dirs_(std::move(other.dirs_)) {
+    other.fd_ = -1;
+}
+
+WorkingDir::~WorkingDir() {
+    if (fd_ != -1) close(fd_);
+}
+
+PathTarget::PathTarget(PathTarget&& other) {
+    *this = std::move(other);
+}
+
+PathTarget& PathTarget::operator=(PathTarget&& other) {
+    if (this != &other) {
+        reset();
+        dirfd = other.dirfd;
+        dir = std::move(other.dir);
+        name = std::move(other.name);
+        owned = other.owned;
+        other.dirfd = -1;
+        other.owned = false;
+    }
+    return *this;
+}
+
+void PathTarget::reset() {
+    if (owned && dirfd != -1) close(dirfd);
+    dirfd = -1;
+    owned = false;
+    dir.clear();
+    name.clear();
+}
+
+PathResolver::PathResolver(const std::string& root) {
+    char buf[PATH_MAX];
+    if (realpath(root.c_str(), buf) == nullptr) ErrorHandler::handleError("Root directory " + root + " not found", true);
+    root_ = buf;
+    root_fd_ = ::open(root_.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd_ == -1) ErrorHandler::handleError("Cannot open root directory " + root_, true);
+
+    // openat2 needs Linux 5.6, fdPath needs /proc
+    use_openat2_ = true;
+    std::string path;
+    int fd = openBeneath(root_fd_, root_, ".", O_PATH | O_DIRECTORY, 0, &path);
+    if (fd == -1 || path != root_) {
+        use_openat2_ = false;
+        Logger::log(Logger::WARNING, "openat2 unavailable, resolving paths with realpath");
+    }
+    if (fd != -1) close(fd);
+}
+
+PathResolver::~PathResolver() {
+    if (root_fd_ != -1) close(root_fd_);
+}
+
+bool PathResolver::within(const std::string& path) const {
+    if (root_ == "/") return true;
+    return path.compare(0, root_.size(), root_) == 0 && (path.size() == root_.size() || path[root_.size()] == '/');
+}
+
+std::string PathResolver::clientPath(const std::string& canonical) const {
+    if (root_ == "/") return canonical;
+    return canonical.size() > root_.size() ? canonical.substr(root_.size()) : "/";
+}
+
+std::string PathResolver::fdPath(int fd) {
+    char link[32], buf[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t n = readlink(link, buf, sizeof(buf));
+    return n > 0 && n < (ssize_t)sizeof(buf) ? std::string(buf, n) : std::string();
+}
+
+static bool hasDotDot(const std::string& rel) {
+    for (size_t pos = rel.find(".."); pos != std::string::npos; pos = rel.find("..", pos + 2)) {
+        bool starts = pos == 0 || rel[pos - 1] == '/';
+        bool ends = pos + 2 == rel.size() || rel[pos + 2] == '/';
+        if (starts && ends) return true;
+    }
+    return false;
+}
+
+// Drops leading and trailing slashes, "" becomes "."
+static std::string relativePart(const std::string& path) {
+    size_t begin = path.find_first_not_of('/');
+    if (begin == std::string::npos) return ".";
+    size_t end = path.find_last_not_of('/');
+    return path.substr(begin, end - begin + 1);
+}
+
+int PathResolver::openBeneath(int base_fd, const std::string& base_abs, const std::string& rel, int flags,
+                              mode_t mode, std::string* canonical) const {
+    if (!use_openat2_) {
+        std::string path = (base_abs == "/" ? "" : base_abs) + "/" + rel;
+        int fd;
+        if (flags & O_CREAT) {
+            // rel is a single name in a checked directory, only a symlink can lead out
+            fd = ::open(path.c_str(), flags | O_NOFOLLOW | O_CLOEXEC, mode);
+        } else {
+            char buf[PATH_MAX];
+            if (realpath(path.c_str(), buf) == nullptr) return -1;
+            path = buf;
+            if (!within(path)) {
+                errno = EXDEV;
+                return -1;
+            }
+            fd = ::open(path.c_str(), flags | O_CLOEXEC);
+        }
+        if (fd != -1 && canonical) *canonical = path;
+        return fd;
+    }
+
+    struct open_how how {};
+    how.flags = flags | O_CLOEXEC;
+    how.mode = (flags & O_CREAT) ? mode : 0;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    int fd;
+    do {
+        fd = (int)syscall(SYS_openat2, base_fd, rel.c_str(), &how, sizeof(how));
+    } while (fd == -1 && (errno == EINTR || errno == EAGAIN)); // EAGAIN: raced with a rename
+    if (fd != -1 && canonical) {
+        *canonical = fdPath(fd);
+        if (canonical->empty()) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+int PathResolver::openFrom(WorkingDir& wd, const std::string& user_path, int flags, std::string* canonical) const {
+    std::string rel = relativePart(user_path);
+    if (!user_path.empty() && user_path[0] == '/') return openBeneath(root_fd_, root_, rel, flags, 0, canonical);
+
+    int fd = openBeneath(baseFd(wd), baseAbs(wd), rel, flags, 0, canonical);
+    // ".." above the working directory is still fine inside the root
+    if (fd == -1 && errno == EXDEV && wd.fd_ != -1)
+        fd = openBeneath(root_fd_, root_, relativePart(wd.path_ + "/" + rel), flags, 0, canonical);
+    return fd;
+}
+
+// Picks up directory renames: cached handles are dropped and the working
+// directory's displayed path is refreshed from its handle
+void PathResolver::sync(WorkingDir& wd) {
+    uint64_t generation = generation_.load();
+    if (wd.dirs_.generation_ == generation) return;
+    wd.dirs_.clear();
+    wd.dirs_.generation_ = generation;
+    if (wd.fd_ == -1 || !use_openat2_) return;
+    std::string abs = fdPath(wd.fd_);
+    if (abs.empty() || !within(abs)) {
+        close(wd.fd_);
+        wd.fd_ = -1;
+        wd.path_ = "/";
+        wd.abs_.clear();
+        return;
+    }
+    wd.abs_ = abs;
+    wd.path_ = clientPath(abs);
+}
+
+int PathResolver::openDir(WorkingDir& wd, const std::string& dir, std::string& dir_abs) {
+    auto& entries = wd.dirs_.entries_;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].key == dir) {
+            std::rotate(entries.begin(), entries.begin() + i, entries.begin() + i + 1);
+            dir_abs = entries[0].path;
+            return entries[0].fd;
+        }
+    }
+
+    // Continue from the deepest cached ancestor. ".." could climb out of
+    // it, so such paths are walked from the start.
+    const int flags = O_PATH | O_DIRECTORY;
+    int fd = -1;
+    if (!hasDotDot(dir)) {
+        const DirHandleCache::Entry* best = nullptr;
+        for (const auto& e : entries) {
+            if (dir.size() > e.key.size() && dir[e.key.size()] == '/' && dir.compare(0, e.key.size(), e.key) == 0 &&
+                (!best || e.key.size() > best->key.size()))
+                best = &e;
+        }
+        if (best) fd = openBeneath(best->fd, best->path, dir.substr(best->key.size() + 1), flags, 0, &dir_abs);
+    }
+    if (fd == -1) fd = openFrom(wd, dir, flags, &dir_abs);
+    if (fd == -1) return -1;
+
+    if (entries.size() >= DirHandleCache::CAPACITY) {
+        close(entries.back().fd);
+        entries.pop_back();
+    }
+    entries.insert(entries.begin(), DirHandleCache::Entry{dir, fd, dir_abs});
+    return fd;
+}
+
+int PathResolver::open(WorkingDir& wd, const std::string& user_path, int flags, std::string* canonical) {
+    sync(wd);
+    size_t slash = user_path.find_last_not_of('/');
+    slash = slash == std::string::npos ? std::string::npos : user_path.rfind('/', slash);
+    if (slash != std::string::npos && slash > 0) {
+        // Files below a directory used before are opened from its cached handle
+        std::string name = relativePart(user_path.substr(slash + 1));
+        if (name != "." && name != "..") {
+            std::string dir_abs;
+            int dirfd = openDir(wd, user_path.substr(0, slash), dir_abs);
+            if (dirfd != -1) {
+                int fd = openBeneath(dirfd, dir_abs, name, flags, 0, canonical);
+                if (fd != -1 || errno != EXDEV) return fd;
+            }
+        }
+    }
+    return openFrom(wd, user_path, flags, canonical);
+}
+
+bool PathResolver::locate(WorkingDir& wd, const std::string& user_path, PathTarget& target, bool own) {
+    target.reset();
+    sync(wd);
+    size_t end = user_path.find_last_not_of('/');
+    if (end == std::string::npos) return false;
+    size_t slash = user_path.rfind('/', end);
+    std::string name = user_path.substr(slash == std::string::npos ? 0 : slash + 1,
+                                        slash == std::string::npos ? end + 1 : end - slash);
+    if (name == "." || name == "..") return false;
+
+    int dirfd;
+    if (slash == std::string::npos) {
+        dirfd = baseFd(wd);
+        target.dir = baseAbs(wd);
+    } else if (slash == 0) {
+        dirfd = root_fd_;
+        target.dir = root_;
+    } else {
+        dirfd = openDir(wd, user_path.substr(0, slash), target.dir);
+        if (dirfd == -1) return false;
+    }
+    if (own) {
+        dirfd = fcntl(dirfd, F_DUPFD_CLOEXEC, 0);
+        if (dirfd == -1) return false;
+    }
+    target.dirfd = dirfd;
+    target.owned = own;
+    target.name = name;
+    return true;
+}
+
+int PathResolver::openAt(const PathTarget& target, int flags, mode_t mode) const {
+    return openBeneath(target.dirfd, target.dir, target.name, flags, mode, nullptr);
+}
+
+bool PathResolver::changeDir(WorkingDir& wd, const std::string& user_path) {
+    std::string abs;
+    int fd = open(wd, user_path, O_PATH | O_DIRECTORY, &abs);
+    if (fd == -1) return false;
+    if (wd.fd_ != -1) close(wd.fd_);
+    if (abs == root_) {
+        close(fd);
+        fd = -1;
+    }
+    wd.fd_ = fd;
+    wd.abs_ = abs;
+    wd.path_ = clientPath(abs);
+    wd.dirs_.clear(); // keys were relative to the old directory
+    return true;
+}
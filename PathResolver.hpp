@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Per-session cache of open handles to directories inside the root, keyed
+// by the path as the client wrote it. Resolving "a/b/c/file" then only walks
+// "file", and a miss on "a/b/c/d" walks on from the cached "a/b/c".
+class DirHandleCache {
+public:
+    static const size_t CAPACITY = 16;
+
+    DirHandleCache() = default;
+    DirHandleCache(DirHandleCache&& other) = default;
+    DirHandleCache(const DirHandleCache&) = delete;
+    DirHandleCache& operator=(const DirHandleCache&) = delete;
+    ~DirHandleCache() { clear(); }
+
+    void clear();
+
+private:
+    friend class PathResolver;
+    struct Entry {
+        std::string key;  // directory path as the client wrote it
+        int fd;           // O_PATH directory handle
+        std::string path; // canonical absolute path
+    };
+    std::vector<Entry> entries_; // front = most recently used
+    uint64_t generation_ = 0;
+};
+
+// A session's working directory, held open so relative paths are walked
+// from it instead of being rebuilt from the root
+class WorkingDir {
+public:
+    WorkingDir() = default;
+    WorkingDir(WorkingDir&& other);
+    WorkingDir(const WorkingDir&) = delete;
+    WorkingDir& operator=(const WorkingDir&) = delete;
+    ~WorkingDir();
+
+    // As shown to the client, "/" is the server root
+    const std::string& path() const { return path_; }
+
+private:
+    friend class PathResolver;
+    int fd_ = -1;        // O_PATH handle, -1 = the root
+    std::string path_ = "/";
+    std::string abs_;    // canonical absolute path, unused for the root
+    DirHandleCache dirs_; // keys relative to this directory
+};
+
+// A directory entry addressed as its parent's handle plus a name, for the
+// *at() calls. The entry itself need not exist.
+struct PathTarget {
+    int dirfd = -1;
+    std::string dir;  // canonical path of the parent
+    std::string name;
+    bool owned = false;
+
+    PathTarget() = default;
+    PathTarget(PathTarget&& other);
+    PathTarget& operator=(PathTarget&& other);
+    PathTarget(const PathTarget&) = delete;
+    PathTarget& operator=(const PathTarget&) = delete;
+    ~PathTarget() { reset(); }
+
+    bool valid() const { return dirfd != -1; }
+    std::string path() const { return (dir == "/" ? "" : dir) + "/" + name; }
+    void reset();
+};
+
+// Maps client paths to files inside the server root. The root is
+// canonicalized and opened once; every lookup is an openat2() with
+// RESOLVE_BENEATH relative to the root or working directory handle, so the
+// kernel refuses ".." and symlink escapes in a single walk. Kernels without
+// openat2 fall back to realpath() and a prefix check against the cached root.
+class PathResolver {
+public:
+    explicit PathResolver(const std::string& root);
+    ~PathResolver();
+
+    const std::string& root() const { return root_; }
+
+    // Opens user_path (relative to wd unless it starts with '/'). canonical
+    // receives its absolute path. -1 with errno set on failure.
+    int open(WorkingDir& wd, const std::string& user_path, int flags, std::string* canonical = nullptr);
+
+    // Finds the parent directory of user_path for the *at() calls. The last
+    // component must be a plain name. With own, target holds its own handle
+    // and stays valid across later lookups.
+    bool locate(WorkingDir& wd, const std::string& user_path, PathTarget& target, bool own = false);
+
+    // Opens or creates target's name inside its parent
+    int openAt(const PathTarget& target, int flags, mode_t mode = 0644) const;
+
+    bool changeDir(WorkingDir& wd, const std::string& user_path);
+
+    // Absolute path as shown to the client, "/" = the root
+    std::string clientPath(const std::string& canonical) const;
+
+    // Call after a directory was renamed or removed: drops the cached
+    // handles of every session on their next lookup
+    void invalidateDirs() { ++generation_; }
+
+private:
+    std::string root_;
+    int root_fd_ = -1;
+    bool use_openat2_ = false;
+    std::atomic<uint64_t> generation_{1};
+
+    bool within(const std::string& path) const;
+    int baseFd(const WorkingDir& wd) const { return wd.fd_ == -1 ? root_fd_ : wd.fd_; }
+    const std::string& baseAbs(const WorkingDir& wd) const { return wd.fd_ == -1 ? root_ : wd.abs_; }
+    void sync(WorkingDir& wd);
+
+    // Opens rel beneath base_fd, whose canonical path is base_abs
+    int openBeneath(int base_fd, const std::string& base_abs, const std::string& rel, int flags, mode_t mode,
+                    std::string* canonical) const;
+    // Opens user_path from the root or wd, whichever it is relative to
+    int openFrom(WorkingDir& wd, const std::string& user_path, int flags, std::string* canonical) const;
+    // Returns a handle to the directory dir owned by wd's cache. -1 on failure.
+    int openDir(WorkingDir& wd, const std::string& dir, std::string& dir_abs);
+    static std::string fdPath(int fd);
+};
@@ -0,0 +1,55 @@
+#include "RateLimiter.hpp"
+
+#include <algorithm>
+#include <thread>
+
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst)
+    : rate_(std::max<uint64_t>(rate, 1)), tat_(Clock::now()) {
+    tolerance_ = cost(std::max<uint64_t>(burst, Throttle::QUANTUM));
+}
+
+TokenBucket::Clock::duration TokenBucket::cost(size_t n) const {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((double)n / rate_));
+}
+
+TokenBucket::Clock::time_point TokenBucket::reserve(size_t n) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Clock::time_point now = Clock::now();
+    // An idle bucket refills up to the burst, no further
+    if (tat_ < now) tat_ = now;
+    tat_ += cost(n);
+    Clock::time_point allowed = tat_ - tolerance_;
+    return allowed > now ? allowed : now;
+}
+
+void TokenBucket::refund(size_t n) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tat_ -= cost(n);
+}
+
+Throttle::Throttle(std::vector<std::shared_ptr<TokenBucket>> buckets)
+    : buckets_(std::move(buckets)), window_start_(TokenBucket::Clock::now()) {}
+
+size_t Throttle::acquire(size_t want) {
+    if (buckets_.empty() || want == 0) return want;
+    size_t n = std::min(want, QUANTUM);
+    TokenBucket::Clock::time_point start = TokenBucket::Clock::now();
+    for (auto& bucket : buckets_) start = std::max(start, bucket->reserve(n));
+    std::this_thread::sleep_until(start);
+    return n;
+}
+
+void Throttle::settle(size_t granted, size_t used) {
+    if (used < granted) {
+        for (auto& bucket : buckets_) bucket->refund(granted - used);
+    }
+    bytes_ += used;
+    window_bytes_ += used;
+    TokenBucket::Clock::time_point now = TokenBucket::Clock::now();
+    double secs = std::chrono::duration<double>(now - window_start_).count();
+    if (secs >= 0.5) {
+        rate_ = (uint64_t)(window_bytes_ / secs);
+        window_bytes_ = 0;
+        window_start_ = now;
+    }
+}
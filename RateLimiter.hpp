@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Token bucket in GCRA form: instead of a token count it keeps the time at
+// which the bucket is empty again. Reservations are served in arrival
+// order, so transfers sharing a bucket take turns one quantum at a time.
+class TokenBucket {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // rate in bytes per second, burst = bytes that may go out at once
+    TokenBucket(uint64_t rate, uint64_t burst);
+
+    uint64_t rate() const { return rate_; }
+
+    // Reserves n bytes and returns when they may be sent
+    Clock::time_point reserve(size_t n);
+    // Returns reserved bytes that were not transferred
+    void refund(size_t n);
+
+private:
+    uint64_t rate_;
+    Clock::duration tolerance_; // burst expressed as time
+    Clock::time_point tat_;     // theoretical arrival time of the next byte
+    std::mutex mutex_;
+
+    Clock::duration cost(size_t n) const;
+};
+
+// Paces one transfer against its session, user and global buckets and
+// measures its rate. Without buckets it only measures.
+class Throttle {
+public:
+    // Largest grant while limited; bounds how long a transfer waits behind
+    // the others sharing a bucket
+    static const size_t QUANTUM = 64 * 1024;
+
+    explicit Throttle(std::vector<std::shared_ptr<TokenBucket>> buckets = {});
+
+    bool limited() const { return !buckets_.empty(); }
+
+    // Blocks until some of want bytes may be transferred, returns how many
+    size_t acquire(size_t want);
+    // Reports how many of the granted bytes were actually transferred
+    void settle(size_t granted, size_t used);
+
+    uint64_t bytes() const { return bytes_; }
+    // Bytes per second over the last half second or so
+    uint64_t rate() const { return rate_; }
+
+private:
+    std::vector<std::shared_ptr<TokenBucket>> buckets_;
+    std::atomic<uint64_t> bytes_{0};
+    std::atomic<uint64_t> rate_{0};
+    TokenBucket::Clock::time_point window_start_;
+    uint64_t window_bytes_ = 0;
+};
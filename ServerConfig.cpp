@@ -0,0 +1,104 @@
+#include "ServerConfig.hpp"
+#include "Logger.hpp"
+#include <fstream>
+#include <cstdlib>
+#include <sstream>
+
+static std::string trim(const std::string& s) {
+    auto begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return "";
+    auto end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+static bool toBool(const std::string& value) {
+    return value == "1" || value == "true" || value == "yes" || value == "on";
+}
+
+// "host:port [advertise]", IPv6 hosts in brackets
+static bool parseListen(const std::string& value, ListenSpec& spec) {
+    std::string hostport = value;
+    auto space = value.find_first_of(" \t");
+    if (space != std::string::npos) {
+        hostport = value.substr(0, space);
+        spec.advertise = trim(value.substr(space));
+    }
+    auto colon = hostport.rfind(':');
+    if (colon == std::string::npos || colon == 0) return false;
+    if (hostport.find(':') != colon && hostport.front() != '[') return false; // bare IPv6 needs brackets
+    spec.address = hostport.substr(0, colon);
+    spec.port = std::atoi(hostport.c_str() + colon + 1);
+    return spec.port > 0;
+}
+
+bool ServerConfig::loadFromFile(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        auto hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        auto eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = trim(line.substr(0, eq));
+        std::string value = trim(line.substr(eq + 1));
+
+        if (key == "port") port = std::atoi(value.c_str());
+        else if (key == "root_dir") root_dir = value;
+        else if (key == "users_file") users_file = value;
+        else if (key == "listen") {
+            ListenSpec spec;
+            if (parseListen(value, spec)) listeners.push_back(spec);
+            else Logger::log(Logger::WARNING, "Invalid listen line: " + value);
+        }
+        else if (key == "listen_backlog") listen_backlog = std::atoi(value.c_str());
+        else if (key == "accept_threads") accept_threads = std::atoi(value.c_str());
+        else if (key == "pasv_address") pasv_address = value;
+        else if (key == "event_loop") event_loop = toBool(value);
+        else if (key == "worker_threads") worker_threads = std::atoi(value.c_str());
+        else if (key == "blocking_threads") blocking_threads = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "blocking_queue") blocking_queue = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "stor_direct_io") stor_direct_io = toBool(value);
+        else if (key == "stor_buffer_size") stor_buffer_size = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "io_uring") io_uring = toBool(value);
+        else if (key == "deflate_level") deflate_level = std::atoi(value.c_str());
+        else if (key == "deflate_threads") deflate_threads = std::strtoul(value.c_str(), nullptr, 10);
+        else if (key == "hash_index_entries") hash_index_entries = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "hash_index") hash_index = value;
+        else if (key == "hash_uploads") hash_uploads = toBool(value);
+        else if (key == "listing_cache_bytes") listing_cache_bytes = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "file_cache_bytes") file_cache_bytes = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "log_async") log_async = toBool(value);
+        else if (key == "log_ring_size") log_ring_size = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "pasv_min_port") pasv_min_port = std::atoi(value.c_str());
+        else if (key == "pasv_max_port") pasv_max_port = std::atoi(value.c_str());
+        else if (key == "auth_threads") auth_threads = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "auth_queue") auth_queue = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "max_sessions") max_sessions = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "max_sessions_per_ip") max_sessions_per_ip = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "max_sessions_per_user") max_sessions_per_user = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "idle_timeout") idle_timeout = std::atoi(value.c_str());
+        else if (key == "data_timeout") data_timeout = std::atoi(value.c_str());
+        else if (key == "rate_limit") rate_limit = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "session_rate_limit") session_rate_limit = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "rate_burst") rate_burst = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "tls_certificate") tls_certificate = value;
+        else if (key == "tls_private_key") tls_private_key = value;
+        else if (key == "tls_required") tls_required = toBool(value);
+        else if (key == "ktls") ktls = toBool(value);
+        else if (key == "stats_admins") {
+            stats_admins.clear();
+            std::istringstream names(value);
+            std::string name;
+            while (std::getline(names, name, ',')) {
+                name = trim(name);
+                if (!name.empty()) stats_admins.push_back(name);
+            }
+        }
+        else if (key == "metrics_listen") {
+            if (!parseListen(value, metrics_listen)) Logger::log(Logger::WARNING, "Invalid metrics_listen: " + value);
+        }
+        else Logger::log(Logger::WARNING, "Unknown config key: " + key);
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <vector>
+
+struct ListenSpec {
+    std::string address = "0.0.0.0"; // numeric IPv4 or IPv6
+    int port = 2121;
+    std::string advertise; // PASV address announced on this listener, empty = pasv_address
+};
+
+struct ServerConfig {
+    int port = 2121;
+    std::string root_dir = "./ftp_root";
+    std::string users_file = "users.txt";
+
+    // "listen = host:port [advertise]" lines, IPv6 as [addr]:port.
+    // Without any, the server listens on 0.0.0.0:port.
+    std::vector<ListenSpec> listeners;
+    int listen_backlog = 511;
+    int accept_threads = 1; // SO_REUSEPORT accept threads per listener (thread per client mode)
+    // Address announced in PASV replies. Empty = the control connection's local address.
+    std::string pasv_address;
+
+    // Session engine: false = one thread per client, true = epoll event loops
+    bool event_loop = false;
+    int worker_threads = 0; // event loops to run, 0 = one per core
+    // Event loop mode: transfers and other blocking commands run on
+    // blocking_threads shared workers. Beyond blocking_queue waiting
+    // sessions, new ones are told 421 and closed.
+    size_t blocking_threads = 128;
+    size_t blocking_queue = 1024;
+
+    // STOR: write with O_DIRECT through an aligned buffer instead of splice(2)
+    bool stor_direct_io = false;
+    size_t stor_buffer_size = 1 << 20;
+
+    // RETR/STOR through io_uring (server built with make IO_URING=1), else
+    // or if the kernel refuses io_uring the sendfile/splice path is used.
+    // Takes precedence over stor_direct_io.
+    bool io_uring = false;
+
+    // MODE Z: zlib level, and threads compressing large files in parallel
+    // blocks (0 = one per core)
+    int deflate_level = 6;
+    unsigned deflate_threads = 0;
+
+    // HASH/XCRC digests remembered per file version, 0 disables the index.
+    // With hash_index set they persist in that file across restarts.
+    size_t hash_index_entries = 100000;
+    std::string hash_index;
+    // STOR hashes the upload while writing it (through a user space buffer
+    // instead of splice) so HASH of the new file is answered from the index
+    bool hash_uploads = false;
+
+    // Rendered directory listings kept in memory, 0 disables the cache
+    size_t listing_cache_bytes = 0;
+
+    // Hot files mapped and shared between concurrent RETRs, 0 disables the cache
+    size_t file_cache_bytes = 0;
+
+    // Asynchronous logging through per-thread ring buffers
+    bool log_async = false;
+    size_t log_ring_size = 4096; // entries per thread, overflow is dropped
+
+    // Passive data ports handed out by PASV/EPSV
+    int pasv_min_port = 20000;
+    int pasv_max_port = 21000;
+
+    // Salted password hashes are checked on auth_threads workers; logins
+    // beyond auth_queue waiting checks are refused
+    size_t auth_threads = 2;
+    size_t auth_queue = 256;
+
+    // Admission control, 0 = unlimited. Refused clients get 421.
+    size_t max_sessions = 1000;
+    size_t max_sessions_per_ip = 0;
+    size_t max_sessions_per_user = 0;
+    // Seconds, 0 = none. idle_timeout ends control connections without
+    // commands; data_timeout bounds waiting for the data connection and
+    // stalls during a transfer.
+    int idle_timeout = 300;
+    int data_timeout = 60;
+
+    // RETR/STOR bandwidth limits in bytes per second, 0 = unlimited. Per-user
+    // limits come from the users file.
+    uint64_t rate_limit = 0;         // all transfers together
+    uint64_t session_rate_limit = 0; // each session
+    uint64_t rate_burst = 256 * 1024;
+
+    // Explicit FTPS (AUTH TLS), off without a certificate. The key may be in
+    // the certificate file. tls_required refuses logins before AUTH TLS and
+    // data connections without PROT P. ktls lets OpenSSL hand encryption to
+    // the kernel so encrypted RETR keeps using sendfile.
+    std::string tls_certificate;
+    std::string tls_private_key;
+    bool tls_required = false;
+    bool ktls = true;
+
+    // Prometheus metrics over HTTP on "metrics_listen = host:port", port 0 = off.
+    // SIGUSR1 writes the same text to the log.
+    ListenSpec metrics_listen{"127.0.0.1", 0, ""};
+    // Users whose SITE STATS lists every session's transfers and the open
+    // files; everyone else sees only their own transfers. The full report is
+    // also at /stats on metrics_listen and in the SIGUSR1 dump.
+    std::vector<std::string> stats_admins;
+
+    // Reads "key = value" lines, '#' starts a comment. Unknown keys are logged and skipped.
+    bool loadFromFile(const std::string& filename);
+};
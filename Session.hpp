@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "FileHash.hpp"
+#include "PathResolver.hpp"
+#include "RateLimiter.hpp"
+
+typedef struct ssl_st SSL;
+
+struct DataConn {
+    int listen_fd = -1;
+    int conn_fd = -1;
+    int port = 0;     // passive: our port, active: the client's
+    bool ready = false;
+    bool active = false;     // PORT/EPRT: connect to the client instead of accepting
+    std::string active_host;
+    SSL* tls = nullptr;      // PROT P, set up once the transfer started
+};
+
+// Per-connection state of one control connection. Kept small, an idle
+// client in event loop mode costs only this object and its socket.
+struct Session {
+    int client_fd = -1;
+    std::string client_ip;
+    int client_port = 0;
+    int listener = 0; // index of the listener that accepted the connection
+    SSL* tls = nullptr;   // after AUTH TLS all control traffic goes through it
+    bool pbsz = false;
+    bool prot_private = false; // PROT P: data connections use TLS
+    bool admitted = false; // counted by AdmissionControl
+    bool logged_in = false;
+    std::string last_user;
+    std::string counted_user; // user counted against max_sessions_per_user
+    DataConn dataconn;
+    bool epsv_all = false; // client sent EPSV ALL, PASV is refused
+    bool mode_z = false;   // MODE Z: transfers are zlib streams
+    FileHash::Algorithm hash_algorithm = FileHash::SHA256; // OPTS HASH
+    off_t alloc_hint = 0;  // ALLO size for the next STOR
+    off_t rest_offset = 0; // REST offset for the next RETR/STOR
+    off_t range_end = -1;  // RANG end byte (inclusive) for the next RETR, -1 = EOF
+    WorkingDir cwd;
+    PathTarget rename_from; // RNFR source, holds its own directory handle
+    std::shared_ptr<TokenBucket> session_bucket; // session_rate_limit
+    std::shared_ptr<TokenBucket> user_bucket;    // shared by the user's sessions
+
+    std::string in_buffer;            // received bytes not yet forming a complete line
+    std::vector<std::string> replies; // queued replies, sent by FtpServer::flushReplies
+};
@@ -0,0 +1,234 @@
+#include "Tls.hpp"
+#include "Logger.hpp"
+#include "RateLimiter.hpp"
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+static const size_t CHUNK_SIZE = 256 * 1024;
+
+static std::string sslError() {
+    unsigned long code = ERR_get_error();
+    if (code == 0) return errno ? strerror(errno) : "connection closed";
+    char buf[256];
+    ERR_error_string_n(code, buf, sizeof(buf));
+    ERR_clear_error();
+    return buf;
+}
+
+Tls::~Tls() {
+    if (ctx_) SSL_CTX_free(ctx_);
+}
+
+bool Tls::init(const std::string& certificate, const std::string& private_key, bool ktls) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) return false;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    if (SSL_CTX_use_certificate_chain_file(ctx, certificate.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, (private_key.empty() ? certificate : private_key).c_str(),
+                                    SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        Logger::log(Logger::ERROR, "Cannot load TLS certificate " + certificate + ": " + sslError());
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    // One session cache for control and data connections
+    static const unsigned char sid_ctx[] = "ftpserver";
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY);
+#ifdef SSL_OP_ENABLE_KTLS
+    if (ktls) SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+    if (ktls) Logger::log(Logger::WARNING, "OpenSSL built without kTLS, encrypting in user space");
+#endif
+    // OpenSSL writes sockets with write(), a closed peer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    ctx_ = ctx;
+    return true;
+}
+
+SSL* Tls::accept(int fd, int timeout) {
+    // Bound the handshake; the socket's own receive timeout comes back after
+    timeval saved{};
+    socklen_t saved_len = sizeof(saved);
+    bool restore = timeout > 0 && getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &saved, &saved_len) == 0;
+    if (restore) {
+        timeval tv{timeout, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    SSL* ssl = SSL_new(ctx_);
+    int rc = -1;
+    if (ssl && SSL_set_fd(ssl, fd) == 1) {
+        do {
+            rc = SSL_accept(ssl);
+        } while (rc != 1 && SSL_get_error(ssl, rc) == SSL_ERROR_SYSCALL && errno == EINTR);
+    }
+    if (restore) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &saved, sizeof(saved));
+    if (rc != 1) {
+        ++failed_;
+        Logger::log(Logger::WARNING, "TLS handshake failed: " + sslError());
+        if (ssl) SSL_free(ssl);
+        return nullptr;
+    }
+    ++handshakes_;
+    if (SSL_session_reused(ssl)) ++resumed_;
+    if (kernelSend(ssl)) ++ktls_send_;
+    return ssl;
+}
+
+void Tls::shutdown(SSL* ssl) {
+    if (!ssl) return;
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    ERR_clear_error();
+}
+
+bool Tls::kernelSend(SSL* ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+    return BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
+bool Tls::write(SSL* ssl, const char* data, size_t len) {
+    while (len > 0) {
+        size_t n = 0;
+        if (SSL_write_ex(ssl, data, len, &n) != 1) {
+            if (SSL_get_error(ssl, 0) == SSL_ERROR_SYSCALL && errno == EINTR) continue;
+            ERR_clear_error();
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+ssize_t Tls::read(SSL* ssl, char* buf, size_t len, bool dont_wait) {
+    int fd = SSL_get_fd(ssl);
+    int flags = 0;
+    if (dont_wait) {
+        flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    size_t n = 0;
+    int rc;
+    do {
+        rc = SSL_read_ex(ssl, buf, len, &n);
+    } while (rc != 1 && SSL_get_error(ssl, rc) == SSL_ERROR_SYSCALL && errno == EINTR);
+    if (dont_wait) fcntl(fd, F_SETFL, flags);
+    if (rc == 1) return n;
+    switch (SSL_get_error(ssl, rc)) {
+    case SSL_ERROR_ZERO_RETURN:
+        return 0; // close_notify
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_SSL:
+        // Includes a TCP close without close_notify, which could be a truncation
+        errno = EPROTO;
+        ERR_clear_error();
+        return -1;
+    default:
+        if (errno == 0) errno = ECONNRESET;
+        ERR_clear_error();
+        return -1;
+    }
+}
+
+bool Tls::pending(SSL* ssl) {
+    return SSL_pending(ssl) > 0;
+}
+
+ssize_t Tls::sendFile(DataChannel& channel, int file_fd, off_t offset, off_t length) {
+    struct stat st;
+    if (fstat(file_fd, &st) == -1) return -1;
+    off_t end = st.st_size;
+    if (length >= 0 && offset + length < end) end = offset + length;
+    posix_fadvise(file_fd, offset, end - offset, POSIX_FADV_SEQUENTIAL);
+    std::vector<char> buf(CHUNK_SIZE);
+    off_t pos = offset;
+    while (pos < end) {
+        size_t want = std::min<off_t>(buf.size(), end - pos);
+        ssize_t n = pread(file_fd, buf.data(), want, pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) {
+            Logger::log(Logger::ERROR, "File shrank during transfer");
+            errno = EIO;
+            return -1;
+        }
+        if (!channel.send(buf.data(), n)) return -1;
+        pos += n;
+    }
+    return pos - offset;
+}
+
+ssize_t Tls::receiveFile(DataChannel& channel, int file_fd, off_t offset, const DataTransfer::Tap& tap) {
+    std::vector<char> buf(CHUNK_SIZE);
+    off_t pos = offset;
+    while (true) {
+        ssize_t n = channel.receive(buf.data(), buf.size());
+        if (n < 0) return -1;
+        if (n == 0) break;
+        if (tap) tap(buf.data(), n);
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = pwrite(file_fd, buf.data() + done, n - done, pos);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            done += w;
+            pos += w;
+        }
+    }
+    return pos - offset;
+}
+
+Tls::Stats Tls::stats() const {
+    Stats s;
+    s.handshakes = handshakes_;
+    s.resumed = resumed_;
+    s.failed = failed_;
+    s.ktls_send = ktls_send_;
+    return s;
+}
+
+bool DataChannel::send(const char* data, size_t len) {
+    if (rawSend()) return DataTransfer::sendBuffer(fd, data, len, throttle);
+    while (len > 0) {
+        size_t want = throttle ? throttle->acquire(std::min(len, CHUNK_SIZE)) : std::min(len, CHUNK_SIZE);
+        bool ok = Tls::write(tls, data, want);
+        if (throttle) throttle->settle(want, ok ? want : 0);
+        if (!ok) return false;
+        data += want;
+        len -= want;
+    }
+    return true;
+}
+
+ssize_t DataChannel::receive(char* buf, size_t len) {
+    size_t want = throttle ? throttle->acquire(len) : len;
+    ssize_t n;
+    do {
+        n = tls ? Tls::read(tls, buf, want) : recv(fd, buf, want, 0);
+    } while (n < 0 && errno == EINTR);
+    if (throttle) throttle->settle(want, n > 0 ? n : 0);
+    return n;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <sys/types.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "DataTransfer.hpp"
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+// One transfer's data connection. With PROT P, tls is its TLS state. When
+// OpenSSL moved encryption into the kernel (kTLS), plain socket writes are
+// encrypted too, so sendfile and the other fd-based paths stay usable.
+struct DataChannel {
+    int fd = -1;
+    SSL* tls = nullptr;
+    bool ktls_send = false;
+    Throttle* throttle = nullptr;
+
+    // Plain writes on fd (sendfile, splice, io_uring) are fine
+    bool rawSend() const { return !tls || ktls_send; }
+    // Plain reads on fd are fine. kTLS receive still needs OpenSSL to
+    // handle the non-data records, so TLS always reads through it.
+    bool rawReceive() const { return !tls; }
+
+    // Sends the whole buffer
+    bool send(const char* data, size_t len);
+    // Up to len bytes, 0 at a clean end of stream, -1 on error
+    ssize_t receive(char* buf, size_t len);
+};
+
+// Explicit FTPS (RFC 4217) on OpenSSL: AUTH TLS upgrades the control
+// connection, PROT P makes every data connection a TLS server connection
+// as well. The shared session cache and tickets let a client resume its
+// control connection's session on each data connection, skipping the full
+// handshake per transfer.
+class Tls {
+public:
+    struct Stats {
+        uint64_t handshakes = 0;
+        uint64_t resumed = 0;
+        uint64_t failed = 0;
+        uint64_t ktls_send = 0; // connections sending through kTLS
+    };
+
+    Tls() = default;
+    ~Tls();
+    Tls(const Tls&) = delete;
+    Tls& operator=(const Tls&) = delete;
+
+    // Loads the certificate chain and key. False (logged) leaves TLS off.
+    bool init(const std::string& certificate, const std::string& private_key, bool ktls);
+    bool enabled() const { return ctx_ != nullptr; }
+
+    // Server handshake on a connected socket, giving up after timeout
+    // seconds without progress (0 = the socket's own timeout). nullptr on failure.
+    SSL* accept(int fd, int timeout);
+    // Sends close_notify without waiting for the peer's and frees ssl.
+    // The socket is left open.
+    static void shutdown(SSL* ssl);
+    static bool kernelSend(SSL* ssl);
+
+    static bool write(SSL* ssl, const char* data, size_t len);
+    // With dont_wait, -1 with errno EAGAIN instead of waiting for the rest
+    // of a record. A receive timeout is EAGAIN too.
+    static ssize_t read(SSL* ssl, char* buf, size_t len, bool dont_wait = false);
+    // Plaintext already decrypted and buffered by OpenSSL
+    static bool pending(SSL* ssl);
+
+    // pread() + SSL_write(), for data channels without kTLS
+    static ssize_t sendFile(DataChannel& channel, int file_fd, off_t offset, off_t length = -1);
+    // SSL_read() + pwrite() until the client's close_notify. tap sees every block.
+    static ssize_t receiveFile(DataChannel& channel, int file_fd, off_t offset,
+                               const DataTransfer::Tap& tap = nullptr);
+
+    Stats stats() const;
+
+private:
+    SSL_CTX* ctx_ = nullptr;
+    std::atomic<uint64_t> handshakes_{0};
+    std::atomic<uint64_t> resumed_{0};
+    std::atomic<uint64_t> failed_{0};
+    std::atomic<uint64_t> ktls_send_{0};
+};
@@ -1,37 +1,194 @@
 #include "UserAuth.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
 #include <fstream>
-#include <sstream>
-#include <iomanip>
+#include <future>
+#include <cstdlib>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/sha.h> // Needs OpenSSL
 
+UserAuth::UserAuth(size_t auth_threads, size_t max_queue)
+    : table_(std::make_shared<const Table>()), max_queue_(max_queue) {
+    for (size_t i = 0; i < std::max<size_t>(auth_threads, 1); ++i) workers_.emplace_back(&UserAuth::workerLoop, this);
+}
+
+UserAuth::~UserAuth() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stopping_ = true;
+    }
+    queue_cv_.notify_all();
+    for (auto& t : workers_) t.join();
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool fromHex(const std::string& hex, std::vector<unsigned char>& out) {
+    if (hex.size() % 2 != 0) return false;
+    out.resize(hex.size() / 2);
+    for (size_t i = 0; i < out.size(); ++i) {
+        int hi = hexValue(hex[2 * i]), lo = hexValue(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return true;
+}
+
+bool UserAuth::parseHash(const std::string& text, User& user) {
+    std::vector<unsigned char> raw;
+    std::string hash_hex = text;
+    if (text.compare(0, 15, "$pbkdf2-sha256$") == 0) {
+        // $pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>
+        size_t salt_pos = text.find('$', 15);
+        size_t hash_pos = salt_pos == std::string::npos ? salt_pos : text.find('$', salt_pos + 1);
+        if (hash_pos == std::string::npos) return false;
+        user.iterations = std::atoi(text.c_str() + 15);
+        if (user.iterations <= 0 || !fromHex(text.substr(salt_pos + 1, hash_pos - salt_pos - 1), user.salt) ||
+            user.salt.empty())
+            return false;
+        hash_hex = text.substr(hash_pos + 1);
+    }
+    if (!fromHex(hash_hex, raw) || raw.size() != user.digest.size()) return false;
+    std::copy(raw.begin(), raw.end(), user.digest.begin());
+    return true;
+}
+
+UserAuth::Digest UserAuth::digest(const User& user, const std::string& password) {
+    Digest out;
+    if (user.salt.empty()) {
+        SHA256(reinterpret_cast<const unsigned char*>(password.data()), password.size(), out.data());
+    } else {
+        PKCS5_PBKDF2_HMAC(password.data(), (int)password.size(), user.salt.data(), (int)user.salt.size(),
+                          user.iterations, EVP_sha256(), (int)out.size(), out.data());
+    }
+    return out;
+}
+
 bool UserAuth::loadFromFile(const std::string& filename) {
-    users_.clear();
+    filename_ = filename;
+    return loadTable(filename);
+}
+
+bool UserAuth::loadTable(const std::string& filename) {
     std::ifstream file(filename);
     if (!file) return false;
+    auto table = std::make_shared<Table>();
     std::string line;
+    int line_no = 0;
     while (std::getline(file, line)) {
+        ++line_no;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
         auto colon = line.find(':');
         if (colon == std::string::npos) continue;
-        std::string user = line.substr(0, colon);
-        std::string hash = line.substr(colon + 1);
-        users_[user] = hash;
+        User user;
+        auto rate = line.find(':', colon + 1);
+        std::string hash = line.substr(colon + 1, rate == std::string::npos ? std::string::npos : rate - colon - 1);
+        if (!parseHash(hash, user)) {
+            Logger::log(Logger::WARNING, filename + ":" + std::to_string(line_no) + ": invalid password hash");
+            continue;
+        }
+        if (rate != std::string::npos) user.rate_limit = std::strtoull(line.c_str() + rate + 1, nullptr, 10);
+        // Only cheap to find out for plain digests
+        user.empty_password = user.salt.empty() && digest(user, "") == user.digest;
+        if (user.iterations > table->unknown.iterations) {
+            table->unknown.iterations = user.iterations;
+            table->unknown.salt.resize(user.salt.size());
+        }
+        table->users[line.substr(0, colon)] = std::move(user);
     }
+    // Random salt and digest, no password matches the dummy
+    User& unknown = table->unknown;
+    RAND_bytes(unknown.digest.data(), (int)unknown.digest.size());
+    if (!unknown.salt.empty()) RAND_bytes(unknown.salt.data(), (int)unknown.salt.size());
+    std::shared_ptr<const Table> snapshot = std::move(table);
+    std::atomic_store(&table_, snapshot);
     return true;
 }
 
-bool UserAuth::checkPassword(const std::string& username, const std::string& password) const {
-    auto it = users_.find(username);
-    if (it == users_.end()) return false;
-    return sha256(password) == it->second;
+bool UserAuth::reload() {
+    return !filename_.empty() && loadTable(filename_);
 }
 
-// Uses OpenSSL SHA256
-std::string UserAuth::sha256(const std::string& input) {
-    unsigned char digest[SHA256_DIGEST_LENGTH];
-    SHA256(reinterpret_cast<const unsigned char*>(input.c_str()), input.size(), digest);
+std::shared_ptr<const UserAuth::Table> UserAuth::snapshot() const {
+    return std::atomic_load(&table_);
+}
+
+const UserAuth::User* UserAuth::find(const Table& table, const std::string& username) const {
+    auto it = table.users.find(username);
+    return it == table.users.end() ? nullptr : &it->second;
+}
+
+// Unknown users are hashed against the table's dummy entry, on the same
+// workers and queue, so neither the reply time nor Busy tells them apart
+// from a wrong password
+UserAuth::Result UserAuth::checkPassword(const std::string& username, const std::string& password) {
+    auto start = Metrics::Clock::now();
+    std::shared_ptr<const Table> table = snapshot();
+    const User* user = find(*table, username);
+    const User& entry = user ? *user : table->unknown;
+
+    bool match;
+    if (entry.salt.empty()) {
+        Digest d = digest(entry, password);
+        match = CRYPTO_memcmp(d.data(), entry.digest.data(), d.size()) == 0;
+    } else {
+        // Waiting on the result below keeps entry and password alive for the job
+        auto task = std::make_shared<std::packaged_task<bool()>>([&entry, &password]() {
+            Digest d = digest(entry, password);
+            return CRYPTO_memcmp(d.data(), entry.digest.data(), d.size()) == 0;
+        });
+        std::future<bool> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            if (queue_.size() >= max_queue_) {
+                Logger::log(Logger::WARNING, "Auth queue full, refusing login for " + username);
+                return Result::Busy;
+            }
+            queue_.push_back([task]() { (*task)(); });
+        }
+        queue_cv_.notify_one();
+        match = result.get();
+    }
+    Metrics::observeSince(Metrics::Auth, start);
+    return user && match ? Result::Ok : Result::Denied;
+}
 
-    std::ostringstream oss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; ++i)
-        oss << std::hex << std::setw(2) << std::setfill('0') << (int)digest[i];
-    return oss.str();
-}
\ No newline at end of file
+void UserAuth::workerLoop() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            queue_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        job();
+    }
+}
+
+bool UserAuth::allowsEmptyPassword(const std::string& username) const {
+    std::shared_ptr<const Table> table = snapshot();
+    const User* user = find(*table, username);
+    return user && user->empty_password;
+}
+
+bool UserAuth::slowHash(const std::string& username) const {
+    std::shared_ptr<const Table> table = snapshot();
+    const User* user = find(*table, username);
+    return !(user ? *user : table->unknown).salt.empty();
+}
+
+uint64_t UserAuth::rateLimit(const std::string& username) const {
+    std::shared_ptr<const Table> table = snapshot();
+    const User* user = find(*table, username);
+    return user ? user->rate_limit : 0;
+}
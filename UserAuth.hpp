@@ -1,13 +1,80 @@
 #pragma once
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
+// Users and their password digests. Lines are "user:hash" with an optional
+// ":rate" limit in bytes per second. hash is either sha256(password) in hex
+// or a salted slow hash "$pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>".
+//
+// The table is an immutable snapshot behind a shared_ptr: lookups copy the
+// pointer, reload() builds a new table and swaps it in, so logins never wait
+// for a reload and sessions keep working while users.txt changes.
 class UserAuth {
 public:
+    enum class Result { Ok, Denied, Busy };
+
+    // Slow hashes run on auth_threads workers; when more than max_queue
+    // checks are waiting, further ones fail with Busy
+    explicit UserAuth(size_t auth_threads = 2, size_t max_queue = 256);
+    ~UserAuth();
+    UserAuth(const UserAuth&) = delete;
+    UserAuth& operator=(const UserAuth&) = delete;
+
+    // Called once at startup; the name is kept for reload()
     bool loadFromFile(const std::string& filename);
-    bool checkPassword(const std::string& username, const std::string& password) const;
+    // Reads the file given to loadFromFile again. The old table stays if that fails.
+    bool reload();
+    const std::string& filename() const { return filename_; }
+
+    Result checkPassword(const std::string& username, const std::string& password);
+    // True if the user's password is empty, decided when the file was read
+    bool allowsEmptyPassword(const std::string& username) const;
+    // True if checking the user's password is expensive enough to keep off I/O threads
+    bool slowHash(const std::string& username) const;
+
+    // Transfer rate limit shared by the user's sessions, 0 = unlimited
+    uint64_t rateLimit(const std::string& username) const;
 
 private:
-    std::unordered_map<std::string, std::string> users_; // username -> md5(password)
-    static std::string sha256(const std::string& input);
+    using Digest = std::array<unsigned char, 32>;
+    struct User {
+        Digest digest{};
+        std::vector<unsigned char> salt; // empty = plain sha256
+        int iterations = 0;
+        bool empty_password = false;
+        uint64_t rate_limit = 0;
+    };
+    struct Table {
+        std::unordered_map<std::string, User> users;
+        // Checked for unknown users: salted like the table's slowest hash,
+        // so unknown names take the same path and time as known ones
+        User unknown;
+    };
+
+    std::string filename_;
+    std::shared_ptr<const Table> table_; // read and replaced with std::atomic_load/store
+
+    // Worker pool for slow hashes
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> queue_;
+    size_t max_queue_;
+    std::mutex queue_mutex_;
+    std::condition_variable queue_cv_;
+    bool stopping_ = false;
+
+    bool loadTable(const std::string& filename);
+    std::shared_ptr<const Table> snapshot() const;
+    const User* find(const Table& table, const std::string& username) const;
+    static bool parseHash(const std::string& text, User& user);
+    static Digest digest(const User& user, const std::string& password);
+    void workerLoop();
 };
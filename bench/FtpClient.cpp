@@ -0,0 +1,119 @@
+#include "FtpClient.hpp"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+FtpClient::~FtpClient() {
+    close();
+}
+
+int FtpClient::connectTo(const std::string& host, int port, int rcvbuf) {
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1) continue;
+        // Must be set before connect to bound the advertised window
+        if (rcvbuf > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd != -1) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+bool FtpClient::connect(const std::string& host, int port) {
+    close();
+    fd_ = connectTo(host, port);
+    return fd_ != -1 && readReply() == 220;
+}
+
+bool FtpClient::login(const std::string& user, const std::string& pass) {
+    int code = command("USER " + user);
+    if (code == 331) code = command("PASS " + pass);
+    return code == 230;
+}
+
+void FtpClient::close() {
+    if (fd_ != -1) ::close(fd_);
+    fd_ = -1;
+    buffer_.clear();
+}
+
+bool FtpClient::readLine(std::string& line) {
+    while (true) {
+        size_t eol = buffer_.find("\r\n");
+        if (eol != std::string::npos) {
+            line = buffer_.substr(0, eol);
+            buffer_.erase(0, eol + 2);
+            return true;
+        }
+        char buf[4096];
+        ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+        if (n <= 0) return false;
+        buffer_.append(buf, n);
+    }
+}
+
+int FtpClient::readReply(std::string* reply) {
+    std::string line;
+    if (fd_ == -1 || !readLine(line) || line.size() < 3) return 0;
+    std::string text = line;
+    // Multi-line replies run until "<code> "
+    if (line.size() > 3 && line[3] == '-') {
+        std::string last = line.substr(0, 3) + " ";
+        do {
+            if (!readLine(line)) return 0;
+            text += "\n" + line;
+        } while (line.compare(0, 4, last) != 0);
+    }
+    if (reply) *reply = text;
+    return std::atoi(text.substr(0, 3).c_str());
+}
+
+bool FtpClient::sendRaw(const std::string& text) {
+    return fd_ != -1 && send(fd_, text.data(), text.size(), MSG_NOSIGNAL) == (ssize_t)text.size();
+}
+
+int FtpClient::command(const std::string& line, std::string* reply) {
+    if (!sendRaw(line + "\r\n")) return 0;
+    return readReply(reply);
+}
+
+bool FtpClient::pasv() {
+    std::string reply;
+    if (command("PASV", &reply) != 227) return false;
+    size_t open = reply.find('(');
+    int h[4], p[2];
+    if (open == std::string::npos ||
+        sscanf(reply.c_str() + open, "(%d,%d,%d,%d,%d,%d)", &h[0], &h[1], &h[2], &h[3], &p[0], &p[1]) != 6)
+        return false;
+    pasv_host_ = std::to_string(h[0]) + "." + std::to_string(h[1]) + "." + std::to_string(h[2]) + "." +
+                 std::to_string(h[3]);
+    pasv_port_ = p[0] * 256 + p[1];
+    return true;
+}
+
+int FtpClient::openPassive() {
+    return pasv() ? connectTo(pasv_host_, pasv_port_) : -1;
+}
+
+off_t FtpClient::size(const std::string& path) {
+    std::string reply;
+    if (command("SIZE " + path, &reply) != 213) return -1;
+    return std::strtoll(reply.c_str() + 4, nullptr, 10);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <sys/types.h>
+
+// Minimal blocking FTP client for the benchmarks. Not used by the server.
+class FtpClient {
+public:
+    FtpClient() = default;
+    ~FtpClient();
+    FtpClient(const FtpClient&) = delete;
+    FtpClient& operator=(const FtpClient&) = delete;
+
+    bool connect(const std::string& host, int port);
+    bool login(const std::string& user, const std::string& pass);
+    void close();
+
+    // Sends one command line and reads the reply. Returns the reply code,
+    // 0 if the connection failed; the full reply text goes to reply.
+    int command(const std::string& line, std::string* reply = nullptr);
+    // Reads one more reply, e.g. the 226 after a transfer
+    int readReply(std::string* reply = nullptr);
+    // Writes raw text without waiting for replies, for pipelining
+    bool sendRaw(const std::string& text);
+
+    // PASV and connects the data socket. Returns its fd or -1.
+    int openPassive();
+    // The address PASV returned last, for tools that relay the connection
+    const std::string& pasvHost() const { return pasv_host_; }
+    int pasvPort() const { return pasv_port_; }
+    // Sends PASV but leaves connecting to the caller
+    bool pasv();
+
+    off_t size(const std::string& path);
+
+    static int connectTo(const std::string& host, int port, int rcvbuf = 0);
+
+private:
+    int fd_ = -1;
+    std::string buffer_;
+    std::string pasv_host_;
+    int pasv_port_ = 0;
+
+    bool readLine(std::string& line);
+};
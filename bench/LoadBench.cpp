@@ -0,0 +1,205 @@
+// Synthetic load: N client threads drive the server over loopback with one
+// workload mix for a fixed time, then ops/s, latency percentiles and data
+// throughput are printed. Run it before and after a change to the server.
+//
+// Mixes:
+//   login    connect, USER/PASS, QUIT per operation (login storm)
+//   list     PASV + LIST of <path> on a logged in session
+//   small    PASV + RETR of a small <path>
+//   large    PASV + RETR of a large <path>
+//   stor     PASV + STOR of <size> bytes to a per-thread file, deleted at the end
+//   pipeline <size> NOOPs written at once, then all replies read
+//
+// Start the server first, then:
+//   make bench && ./bench/load_bench <host> <port> <user> <pass> <mix> [threads] [seconds] [path|size]
+
+#include "FtpClient.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static std::string host, user, pass, mix, path;
+static int port;
+static long long size_arg = 0;
+static std::atomic<bool> stop{false};
+
+struct ThreadResult {
+    std::vector<double> latencies_ms;
+    long long bytes = 0;
+    long long errors = 0;
+};
+
+// Reads the data connection to EOF, returns the byte count or -1
+static long long drain(int fd) {
+    if (fd == -1) return -1;
+    static thread_local std::vector<char> buf(256 * 1024);
+    long long total = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf.data(), buf.size(), 0)) > 0) total += n;
+    close(fd);
+    return n == 0 ? total : -1;
+}
+
+// Sends size bytes on the data connection and closes it
+static long long fill(int fd, long long size) {
+    if (fd == -1) return -1;
+    static thread_local std::vector<char> buf(256 * 1024, 'x');
+    long long total = 0;
+    while (total < size) {
+        ssize_t n = send(fd, buf.data(), (size_t)std::min<long long>(buf.size(), size - total), MSG_NOSIGNAL);
+        if (n <= 0) break;
+        total += n;
+    }
+    close(fd);
+    return total == size ? total : -1;
+}
+
+// One operation of the mix. Returns the data bytes moved, -1 on error.
+static long long runOp(FtpClient& ftp, int thread) {
+    if (mix == "login") {
+        FtpClient c;
+        bool ok = c.connect(host, port) && c.login(user, pass) && c.command("QUIT") == 221;
+        return ok ? 0 : -1;
+    }
+    if (mix == "pipeline") {
+        std::string batch;
+        for (long long i = 0; i < size_arg; ++i) batch += "NOOP\r\n";
+        if (!ftp.sendRaw(batch)) return -1;
+        for (long long i = 0; i < size_arg; ++i) {
+            if (ftp.readReply() != 200) return -1;
+        }
+        return 0;
+    }
+    long long n;
+    if (mix == "stor") {
+        std::string name = "load_bench_" + std::to_string(thread) + ".tmp";
+        // PASV goes first: connecting after STOR would wait on the 150
+        if (!ftp.pasv()) return -1;
+        int fd = FtpClient::connectTo(ftp.pasvHost(), ftp.pasvPort());
+        if (ftp.command("STOR " + name) != 150) {
+            if (fd != -1) close(fd);
+            return -1;
+        }
+        n = fill(fd, size_arg);
+    } else {
+        if (!ftp.pasv()) return -1;
+        int fd = FtpClient::connectTo(ftp.pasvHost(), ftp.pasvPort());
+        std::string verb = mix == "list" ? "LIST " : "RETR ";
+        int code = ftp.command(verb + path);
+        if (code != 150) {
+            if (fd != -1) close(fd);
+            return -1;
+        }
+        n = drain(fd);
+    }
+    if (ftp.readReply() != 226) return -1;
+    return n;
+}
+
+static void worker(int thread, ThreadResult& result) {
+    FtpClient ftp;
+    bool needs_session = mix != "login";
+    while (!stop.load(std::memory_order_relaxed)) {
+        if (needs_session && !ftp.connect(host, port)) {
+            ++result.errors;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        if (needs_session && (!ftp.login(user, pass) || ftp.command("TYPE I") != 200)) {
+            ++result.errors;
+            ftp.close();
+            continue;
+        }
+        // Reuse the session until an operation fails
+        while (!stop.load(std::memory_order_relaxed)) {
+            auto start = Clock::now();
+            long long n = runOp(ftp, thread);
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if (n < 0) {
+                ++result.errors;
+                break;
+            }
+            result.latencies_ms.push_back(ms);
+            result.bytes += n;
+        }
+        ftp.close();
+    }
+    if (mix == "stor") {
+        FtpClient c;
+        if (c.connect(host, port) && c.login(user, pass))
+            c.command("DELE load_bench_" + std::to_string(thread) + ".tmp");
+    }
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[i];
+}
+
+int main(int argc, char** argv) {
+    if (argc < 6) {
+        fprintf(stderr,
+                "usage: %s host port user pass login|list|small|large|stor|pipeline [threads] [seconds] "
+                "[path|size]\n",
+                argv[0]);
+        return 1;
+    }
+    host = argv[1];
+    port = atoi(argv[2]);
+    user = argv[3];
+    pass = argv[4];
+    mix = argv[5];
+    int threads = argc > 6 ? atoi(argv[6]) : 8;
+    int seconds = argc > 7 ? atoi(argv[7]) : 10;
+    std::string arg = argc > 8 ? argv[8] : "";
+
+    if (mix == "list") path = arg.empty() ? "." : arg;
+    else if (mix == "small" || mix == "large") path = arg;
+    else if (mix == "stor") size_arg = arg.empty() ? 16 << 20 : atoll(arg.c_str());
+    else if (mix == "pipeline") size_arg = arg.empty() ? 16 : atoll(arg.c_str());
+    else if (mix != "login") {
+        fprintf(stderr, "unknown mix %s\n", mix.c_str());
+        return 1;
+    }
+    if ((mix == "small" || mix == "large") && path.empty()) {
+        fprintf(stderr, "%s needs a file to download\n", mix.c_str());
+        return 1;
+    }
+
+    std::vector<ThreadResult> results(threads);
+    std::vector<std::thread> pool;
+    auto start = Clock::now();
+    for (int i = 0; i < threads; ++i) pool.emplace_back(worker, i, std::ref(results[i]));
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto& t : pool) t.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> latencies;
+    long long bytes = 0, errors = 0;
+    for (const ThreadResult& r : results) {
+        latencies.insert(latencies.end(), r.latencies_ms.begin(), r.latencies_ms.end());
+        bytes += r.bytes;
+        errors += r.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("mix %s, %d threads, %.1f s\n", mix.c_str(), threads, elapsed);
+    printf("%-10s %12s %10s %10s %10s %10s %8s\n", "ops", "ops/s", "p50 ms", "p99 ms", "max ms", "MB/s", "errors");
+    printf("%-10zu %12.0f %10.3f %10.3f %10.3f %10.1f %8lld\n", latencies.size(), latencies.size() / elapsed,
+           percentile(latencies, 0.50), percentile(latencies, 0.99), latencies.empty() ? 0 : latencies.back(),
+           bytes / elapsed / 1e6, errors);
+    return errors > 0 && latencies.empty() ? 1 : 0;
+}
@@ -0,0 +1,89 @@
+// Command parse + dispatch cost: the old string-copying parser with an
+// if/else chain of string compares vs CommandParser::parse and a handler
+// table indexed by CommandId (what FtpServer::processCommand does).
+//
+//   make bench && ./bench/parser_bench [iterations]
+
+#include "../CommandParser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <tuple>
+#include <vector>
+
+static std::tuple<std::string, std::string> legacyParse(const std::string& line) {
+    std::string trimmed = line;
+    while (!trimmed.empty() && (trimmed.back() == '\r' || trimmed.back() == '\n')) {
+        trimmed.pop_back();
+    }
+    auto space = trimmed.find(' ');
+    if (space == std::string::npos) {
+        std::string cmd = trimmed;
+        std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+        return {cmd, ""};
+    }
+    std::string cmd = trimmed.substr(0, space);
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    std::string arg = trimmed.substr(space + 1);
+    return {cmd, arg};
+}
+
+static volatile size_t sink;
+
+static int legacyDispatch(const std::string& cmd, const std::string& arg) {
+    if (cmd == "USER") return 1;
+    else if (cmd == "PASS") return 2;
+    else if (cmd == "NOOP") return 3;
+    else if (cmd == "QUIT") return 4;
+    else if (cmd == "PASV") return 5;
+    else if (cmd == "LIST" || cmd == "NLST" || cmd == "MLSD") return 6 + (int)arg.size();
+    else if (cmd == "RETR") return 7 + (int)arg.size();
+    else if (cmd == "STOR") return 8 + (int)arg.size();
+    else if (cmd == "ALLO") return 9;
+    else if (cmd == "DELE") return 10;
+    else if (cmd == "RNFR") return 11;
+    else if (cmd == "RNTO") return 12;
+    else if (cmd == "SITE") return 13;
+    return 0;
+}
+
+using Handler = int (*)(const Command&);
+static int handleArg(const Command& c) { return (int)c.arg.size(); }
+static int handleNone(const Command&) { return 1; }
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? std::atol(argv[1]) : 2000000;
+    std::vector<std::string> lines = {
+        "USER test\r\n", "PASS test\r\n", "TYPE I\r\n", "PASV\r\n", "LIST -la\r\n",
+        "RETR images/2024/01/firmware-v1.2.3.bin\r\n", "STOR upload/data.csv\r\n", "NOOP\r\n",
+        "DELE old.log\r\n", "rnfr a.txt\r\n", "RNTO b.txt\r\n", "SITE STATS\r\n", "QUIT\r\n",
+    };
+
+    Handler table[(size_t)CommandId::Count];
+    for (auto& h : table) h = handleNone;
+    table[(size_t)CommandId::LIST] = table[(size_t)CommandId::RETR] = table[(size_t)CommandId::STOR] = handleArg;
+
+    auto t0 = std::chrono::steady_clock::now();
+    size_t acc = 0;
+    for (long i = 0; i < iterations; ++i) {
+        auto [cmd, arg] = legacyParse(lines[i % lines.size()]);
+        acc += legacyDispatch(cmd, arg);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        Command c = CommandParser::parse(lines[i % lines.size()]);
+        acc += table[(size_t)c.id](c);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    sink = acc;
+
+    double legacy = std::chrono::duration<double, std::nano>(t1 - t0).count() / iterations;
+    double table_ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / iterations;
+    std::printf("%ld commands\n", iterations);
+    std::printf("  legacy parse + if/else chain  %6.1f ns/cmd\n", legacy);
+    std::printf("  string_view parse + table     %6.1f ns/cmd\n", table_ns);
+    return 0;
+}
@@ -0,0 +1,119 @@
+// PASV data socket setup latency with many sessions holding passive ports:
+// the old linear bind() scan from the bottom of the range vs
+// PassivePortAllocator.
+//
+//   make bench && ./bench/pasv_bench [held_sessions] [min_port] [max_port] [samples]
+
+#include "../PassivePortAllocator.hpp"
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static int min_port, max_port;
+
+static int listenOn(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// The pre-allocator openPassiveDataConn
+static int legacyOpen(int& port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    for (int p = min_port; p <= max_port; ++p) {
+        addr.sin_port = htons(p);
+        if (bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+            port = p;
+            listen(fd, 1);
+            return fd;
+        }
+    }
+    close(fd);
+    return -1;
+}
+
+static int allocatorOpen(PassivePortAllocator& ports, int& port) {
+    for (int attempt = 0; attempt < 8; ++attempt) {
+        port = ports.acquire();
+        if (port == 0) return -1;
+        int fd = listenOn(port);
+        if (fd != -1) return fd;
+        ports.release(port);
+    }
+    return -1;
+}
+
+static void report(const char* name, std::vector<double>& us) {
+    std::sort(us.begin(), us.end());
+    double sum = 0;
+    for (double v : us) sum += v;
+    std::printf("  %-16s mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n", name, sum / us.size(),
+                us[us.size() / 2], us[us.size() * 99 / 100]);
+}
+
+int main(int argc, char** argv) {
+    int held = argc > 1 ? std::atoi(argv[1]) : 5000;
+    min_port = argc > 2 ? std::atoi(argv[2]) : 20000;
+    max_port = argc > 3 ? std::atoi(argv[3]) : 29999;
+    int samples = argc > 4 ? std::atoi(argv[4]) : 200;
+
+    rlimit lim;
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    std::printf("%d sessions holding ports in %d-%d, %d PASV samples\n", held, min_port, max_port, samples);
+
+    using clock = std::chrono::steady_clock;
+    {
+        std::vector<int> fds;
+        int port;
+        for (int i = 0; i < held; ++i) fds.push_back(legacyOpen(port));
+        std::vector<double> us;
+        for (int i = 0; i < samples; ++i) {
+            auto t0 = clock::now();
+            int fd = legacyOpen(port);
+            us.push_back(std::chrono::duration<double, std::micro>(clock::now() - t0).count());
+            if (fd != -1) close(fd);
+        }
+        report("linear scan", us);
+        for (int fd : fds) if (fd != -1) close(fd);
+    }
+    {
+        PassivePortAllocator ports(min_port, max_port);
+        std::vector<int> fds;
+        int port;
+        for (int i = 0; i < held; ++i) fds.push_back(allocatorOpen(ports, port));
+        std::vector<double> us;
+        for (int i = 0; i < samples; ++i) {
+            auto t0 = clock::now();
+            int fd = allocatorOpen(ports, port);
+            us.push_back(std::chrono::duration<double, std::micro>(clock::now() - t0).count());
+            if (fd != -1) {
+                close(fd);
+                ports.release(port);
+            }
+        }
+        report("allocator", us);
+        for (int fd : fds) if (fd != -1) close(fd);
+    }
+    return 0;
+}
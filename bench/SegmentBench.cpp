@@ -0,0 +1,130 @@
+// Aggregate download throughput of one file split into N byte ranges, each
+// fetched with RANG + RETR over its own control and data connection, on a
+// simulated long fat network. An in-process delay proxy sits on every data
+// connection and forwards at most one window per round trip, which is how a
+// single TCP stream behaves on a WAN link; no tc/netem is needed.
+//
+// Start the server first, then:
+//   make bench && ./bench/segment_bench <host> <port> <user> <pass> <file> [rtt_ms] [window_kb] [max_segments]
+
+#include "FtpClient.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static std::string host, user, pass, file;
+static int port;
+static std::chrono::milliseconds rtt(20);
+static size_t window = 256 * 1024;
+
+// Relays upstream to downstream, one window per round trip
+static void delayProxy(int upstream, int downstream) {
+    std::vector<char> buf(window);
+    while (true) {
+        auto deadline = Clock::now() + rtt;
+        size_t got = 0;
+        while (got < window) {
+            ssize_t n = recv(upstream, buf.data() + got, window - got, 0);
+            if (n <= 0) break;
+            got += n;
+        }
+        for (size_t off = 0; off < got;) {
+            ssize_t n = send(downstream, buf.data() + off, got - off, MSG_NOSIGNAL);
+            if (n <= 0) {
+                got = 0;
+                break;
+            }
+            off += n;
+        }
+        if (got < window) break;
+        std::this_thread::sleep_until(deadline);
+    }
+    close(upstream);
+    close(downstream);
+}
+
+// Fetches [first, last] and returns the number of bytes received, -1 on error
+static long long fetchSegment(off_t first, off_t last) {
+    FtpClient ftp;
+    if (!ftp.connect(host, port) || !ftp.login(user, pass) || ftp.command("TYPE I") != 200 || !ftp.pasv())
+        return -1;
+    int upstream = FtpClient::connectTo(ftp.pasvHost(), ftp.pasvPort(), (int)window);
+    int pair[2];
+    if (upstream == -1 || socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) return -1;
+    std::thread proxy(delayProxy, upstream, pair[1]);
+
+    long long received = -1;
+    if (ftp.command("RANG " + std::to_string(first) + " " + std::to_string(last)) == 350 &&
+        ftp.command("RETR " + file) == 150) {
+        received = 0;
+        std::vector<char> buf(256 * 1024);
+        ssize_t n;
+        while ((n = recv(pair[0], buf.data(), buf.size(), 0)) > 0) received += n;
+        if (ftp.readReply() != 226) received = -1;
+    }
+    close(pair[0]);
+    proxy.join();
+    return received;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 6) {
+        fprintf(stderr, "usage: %s host port user pass file [rtt_ms] [window_kb] [max_segments]\n", argv[0]);
+        return 1;
+    }
+    host = argv[1];
+    port = atoi(argv[2]);
+    user = argv[3];
+    pass = argv[4];
+    file = argv[5];
+    if (argc > 6) rtt = std::chrono::milliseconds(atoi(argv[6]));
+    if (argc > 7) window = (size_t)atoi(argv[7]) * 1024;
+    int max_segments = argc > 8 ? atoi(argv[8]) : 8;
+
+    FtpClient probe;
+    off_t size = probe.connect(host, port) && probe.login(user, pass) ? probe.size(file) : -1;
+    probe.close();
+    if (size <= 0) {
+        fprintf(stderr, "cannot get the size of %s\n", file.c_str());
+        return 1;
+    }
+
+    printf("%s: %lld bytes, rtt %lld ms, window %zu KB\n", file.c_str(), (long long)size, (long long)rtt.count(),
+           window / 1024);
+    printf("%-10s %12s %12s\n", "segments", "seconds", "MB/s");
+    for (int segments = 1; segments <= max_segments; segments *= 2) {
+        std::vector<std::thread> threads;
+        std::atomic<long long> total{0};
+        std::atomic<bool> failed{false};
+        off_t per = (size + segments - 1) / segments;
+        auto start = Clock::now();
+        for (int i = 0; i < segments; ++i) {
+            off_t first = i * per;
+            off_t last = std::min<off_t>(size, first + per) - 1;
+            if (first > last) break;
+            threads.emplace_back([&, first, last] {
+                long long n = fetchSegment(first, last);
+                if (n != last - first + 1) failed = true;
+                else total += n;
+            });
+        }
+        for (auto& t : threads) t.join();
+        double secs = std::chrono::duration<double>(Clock::now() - start).count();
+        if (failed) {
+            printf("%-10d failed\n", segments);
+            continue;
+        }
+        printf("%-10d %12.2f %12.1f\n", segments, secs, total / secs / 1e6);
+    }
+    return 0;
+}
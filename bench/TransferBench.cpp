@@ -0,0 +1,142 @@
+// RETR and STOR throughput of the DataTransfer paths: legacy 4 KB
+// read+send loop, sendfile/splice, and io_uring when built with IO_URING=1.
+// Streams a temp file over loopback TCP connections; with streams > 1 that
+// many transfers run at once, each on its own thread.
+//
+//   make bench && ./bench/transfer_bench [size_mb] [rounds] [streams]
+//   make clean && make IO_URING=1 bench    (adds the io_uring rows)
+
+#include "../DataTransfer.hpp"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void connectedPair(int& sender, int& receiver) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(lfd, (sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, (sockaddr*)&addr, &len);
+    listen(lfd, 1);
+    sender = socket(AF_INET, SOCK_STREAM, 0);
+    connect(sender, (sockaddr*)&addr, sizeof(addr));
+    receiver = accept(lfd, nullptr, nullptr);
+    close(lfd);
+}
+
+// Sends the file over a fresh connection, returns the bytes sent
+static ssize_t sendOnce(const std::string& path, const std::function<ssize_t(int, int)>& send_fn) {
+    int sender, receiver;
+    connectedPair(sender, receiver);
+    std::thread drain([receiver]() {
+        std::vector<char> buf(1 << 20);
+        while (recv(receiver, buf.data(), buf.size(), 0) > 0) {}
+        close(receiver);
+    });
+    int file_fd = open(path.c_str(), O_RDONLY);
+    ssize_t bytes = send_fn(sender, file_fd);
+    shutdown(sender, SHUT_WR);
+    drain.join();
+    close(file_fd);
+    close(sender);
+    return bytes;
+}
+
+// Receives size_mb into a new temp file, returns the bytes written
+static ssize_t receiveOnce(int size_mb, const std::function<ssize_t(int, int)>& receive_fn) {
+    int sender, receiver;
+    connectedPair(sender, receiver);
+    std::thread feed([sender, size_mb]() {
+        std::vector<char> block(1 << 20, 'x');
+        for (int i = 0; i < size_mb; ++i) {
+            if (send(sender, block.data(), block.size(), MSG_NOSIGNAL) != (ssize_t)block.size()) break;
+        }
+        close(sender);
+    });
+    char temp[] = "/tmp/ftp_transfer_benchXXXXXX";
+    int file_fd = mkstemp(temp);
+    unlink(temp);
+    ssize_t bytes = receive_fn(receiver, file_fd);
+    feed.join();
+    close(file_fd);
+    close(receiver);
+    return bytes;
+}
+
+// Runs fn on `streams` threads at once, returns seconds and total bytes
+static double runStreams(int streams, const std::function<ssize_t()>& fn, ssize_t& bytes) {
+    std::vector<std::thread> threads;
+    std::vector<ssize_t> results(streams);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < streams; ++i) threads.emplace_back([&, i]() { results[i] = fn(); });
+    for (auto& t : threads) t.join();
+    auto end = std::chrono::steady_clock::now();
+    bytes = 0;
+    for (ssize_t n : results) bytes += n;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char** argv) {
+    int size_mb = argc > 1 ? std::atoi(argv[1]) : 512;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 3;
+    int streams = argc > 3 ? std::atoi(argv[3]) : 1;
+
+    char path[] = "/tmp/ftp_transfer_benchXXXXXX";
+    int fd = mkstemp(path);
+    std::vector<char> block(1 << 20, 'x');
+    for (int i = 0; i < size_mb; ++i) {
+        if (write(fd, block.data(), block.size()) != (ssize_t)block.size()) {
+            std::perror("write");
+            return 1;
+        }
+    }
+    close(fd);
+
+    struct Variant {
+        const char* name;
+        std::function<ssize_t()> fn;
+    };
+    std::string file = path;
+    auto sender = [file](std::function<ssize_t(int, int)> fn) {
+        return [file, fn]() { return sendOnce(file, fn); };
+    };
+    auto receiver = [size_mb](std::function<ssize_t(int, int)> fn) {
+        return [size_mb, fn]() { return receiveOnce(size_mb, fn); };
+    };
+    std::vector<Variant> variants = {
+        {"RETR read+send 4K", sender([](int s, int f) { return DataTransfer::sendFileBuffered(s, f, 0, 4096); })},
+        {"RETR read+send 64K",
+         sender([](int s, int f) { return DataTransfer::sendFileBuffered(s, f, 0, 64 * 1024); })},
+        {"RETR sendfile", sender([](int s, int f) { return DataTransfer::sendFile(s, f, 0); })},
+        {"STOR recv+write 1M", receiver([](int s, int f) { return DataTransfer::receiveFileBuffered(s, f, 0); })},
+        {"STOR splice", receiver([](int s, int f) { return DataTransfer::receiveFile(s, f, 0); })},
+    };
+    if (DataTransfer::uringAvailable()) {
+        variants.push_back({"RETR io_uring", sender([](int s, int f) { return DataTransfer::sendFileUring(s, f, 0); })});
+        variants.push_back(
+            {"STOR io_uring", receiver([](int s, int f) { return DataTransfer::receiveFileUring(s, f, 0); })});
+    }
+
+    std::printf("%d MB file, %d stream(s), best of %d rounds over loopback TCP\n", size_mb, streams, rounds);
+    for (auto& v : variants) {
+        double best = 1e9;
+        ssize_t bytes = 0;
+        for (int r = 0; r < rounds; ++r) best = std::min(best, runStreams(streams, v.fn, bytes));
+        std::printf("  %-20s %8.1f MB/s  (%zd bytes)\n", v.name, bytes / best / (1 << 20), bytes);
+    }
+    unlink(path);
+    return 0;
+}
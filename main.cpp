@@ -2,13 +2,21 @@
 #include "Logger.hpp"
 
 int main() {
+    // Threads inherit the mask, the server's signal thread takes them
+    FtpServer::blockSignals();
 
     Logger::init("ftpserver.log"); // or "" for console only
 
-    FtpServer server(2121, "./ftp_root");
+    ServerConfig config; // defaults: port 2121, root ./ftp_root
+    if (config.loadFromFile("ftpserver.conf"))
+        Logger::log(Logger::INFO, "Loaded configuration from ftpserver.conf");
+    if (config.log_async)
+        Logger::startAsync(config.log_ring_size);
+
+    FtpServer server(config);
     server.run();
 
     Logger::close();
     
     return 0;
-}
\ No newline at end of file
+}